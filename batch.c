@@ -0,0 +1,452 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         batch.c                                                  */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Batch mode shared by the tools. A list of jobs (or all   */
+/*               files in a directory) is converted on a pool of threads, */
+/*               reporting the status and throughput of every file.       */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "castools.h"
+#include "batch.h"
+
+/* longest line in a job list */
+#define LINE_SIZE         4096
+
+/* jobs shared by the threads */
+typedef struct
+{
+  JOB     *jobs;
+  int32_t  count;
+  int32_t  next;         /* first job not taken by a thread */
+  CONVERT  convert;
+  FILE    *report;       /* the messages of the jobs and how they did */
+  pthread_mutex_t lock;
+  pthread_mutex_t output; /* one job at a time shows its messages */
+} POOL;
+
+
+
+/* copy a string, exits if memory runs out */
+char *copyString(const char *string, size_t length)
+{
+  char *copy;
+
+  if ((copy=(char*)malloc(length+1))==NULL) {
+    fprintf(stderr,"Not enough memory!\n");
+    exit(1);
+  }
+
+  memcpy(copy,string,length);
+  copy[length]='\0';
+
+  return copy;
+}
+
+
+
+/* add a job to the list */
+JOB *addJob(JOB *jobs, int32_t *count, int32_t *allocated)
+{
+  if (*count==*allocated) {
+
+    *allocated= *allocated ? 2**allocated : 64;
+    if ((jobs=(JOB*)realloc(jobs,*allocated*sizeof(JOB)))==NULL) {
+      fprintf(stderr,"Not enough memory!\n");
+      exit(1);
+    }
+  }
+
+  memset(&jobs[*count],0,sizeof(JOB));
+  (*count)++;
+
+  return jobs;
+}
+
+
+
+/* split a line in words, words with spaces can be put between quotes */
+int splitLine(char *line, char **words, int size)
+{
+  char *start;
+  int   count = 0;
+
+  for (;;) {
+
+    while (isspace((unsigned char)*line)) line++;
+    if (*line=='\0' || *line=='#' || count==size) break;
+
+    if (*line=='"') {
+      start=++line;
+      while (*line!='\0' && *line!='"') line++;
+    } else {
+      start=line;
+      while (*line!='\0' && !isspace((unsigned char)*line)) line++;
+    }
+
+    words[count++]=copyString(start,line-start);
+    if (*line!='\0') line++;
+  }
+
+  return count;
+}
+
+
+
+/* check the extension of a file name, in any case */
+int hasExtension(const char *name, const char *extension)
+{
+  size_t length=strlen(name), size=strlen(extension);
+  size_t i;
+
+  if (length<=size) return 0;
+  for (i=0;i<size;i++)
+    if (tolower((unsigned char)name[length-size+i])!=
+	tolower((unsigned char)extension[i])) return 0;
+
+  return 1;
+}
+
+
+
+/* name the output after the input, with extension to instead of from */
+char *outputName(const char *input, const char *from, const char *to)
+{
+  size_t length=strlen(input);
+  char  *name;
+
+  if (hasExtension(input,from)) length-=strlen(from);
+
+  name=copyString(input,length+strlen(to));
+  strcpy(name+length,to);
+
+  return name;
+}
+
+
+
+/* read a job list, each line holds the input file, the output file and */
+/* options for that job only. Empty lines and comments (#) are skipped   */
+JOB *readJobs(char *progname, char *name, const char *from, const char *to,
+	      int32_t *count)
+{
+  FILE    *list;
+  JOB     *jobs = NULL;
+  JOB     *job;
+  int32_t  allocated = 0;
+  char     line[LINE_SIZE];
+  char    *words[LINE_SIZE/2];
+  int      n,first;
+
+  *count=0;
+  if ((list=fopen(name,"r"))==NULL) return NULL;
+
+  while (fgets(line,sizeof(line),list)) {
+
+    if ((n=splitLine(line,words,LINE_SIZE/2))==0) continue;
+
+    jobs=addJob(jobs,count,&allocated);
+    job=&jobs[*count-1];
+    job->input=words[0];
+    first=1;
+
+    /* the output can be left out, options start with a dash */
+    if (n>1 && words[1][0]!='-') job->output=words[first++];
+    else if (to) job->output=outputName(job->input,from,to);
+
+    /* options are parsed like the command line, after the program name */
+    job->argc=n-first+1;
+    job->argv=(char**)malloc((n-first+2)*sizeof(char*));
+    if (job->argv==NULL) { fprintf(stderr,"Not enough memory!\n"); exit(1); }
+    job->argv[0]=progname;
+    memcpy(job->argv+1,words+first,(n-first)*sizeof(char*));
+    job->argv[n-first+1]=NULL;
+  }
+
+  fclose(list);
+
+  /* an empty list is not an error */
+  if (jobs==NULL) jobs=(JOB*)malloc(sizeof(JOB));
+  return jobs;
+}
+
+
+
+/* order jobs on their input file name */
+int compareJobs(const void *a, const void *b)
+{
+  return strcmp(((const JOB*)a)->input,((const JOB*)b)->input);
+}
+
+
+
+/* make a job for all files with extension from in a directory */
+JOB *findJobs(char *progname, char *name, const char *from, const char *to,
+	      int32_t *count)
+{
+  DIR     *dir;
+  struct dirent *entry;
+  JOB     *jobs = NULL;
+  JOB     *job;
+  int32_t  allocated = 0;
+
+  *count=0;
+  if ((dir=opendir(name))==NULL) return NULL;
+
+  while ((entry=readdir(dir))!=NULL) {
+
+    if (!hasExtension(entry->d_name,from)) continue;
+
+    jobs=addJob(jobs,count,&allocated);
+    job=&jobs[*count-1];
+
+    job->input=(char*)malloc(strlen(name)+strlen(entry->d_name)+2);
+    job->argv=(char**)calloc(2,sizeof(char*));
+    if (job->input==NULL || job->argv==NULL) {
+      fprintf(stderr,"Not enough memory!\n");
+      exit(1);
+    }
+
+    /* the output is put next to the input */
+    sprintf(job->input,"%s/%s",name,entry->d_name);
+    if (to) job->output=outputName(job->input,from,to);
+
+    job->argc=1;
+    job->argv[0]=progname;
+  }
+
+  closedir(dir);
+
+  /* directories are not read in any order */
+  if (jobs) qsort(jobs,*count,sizeof(JOB),compareJobs);
+  else jobs=(JOB*)malloc(sizeof(JOB));
+
+  return jobs;
+}
+
+
+
+/* get the size of a file */
+int64_t fileSize(char *name)
+{
+  struct stat info;
+  return stat(name,&info) ? 0 : (int64_t)info.st_size;
+}
+
+
+
+/* batch thread, takes jobs until all are taken */
+void *runJobs(void *arg)
+{
+  POOL   *pool = (POOL*)arg;
+  JOB    *job;
+  double  start;
+  char    buffer[4096];
+  size_t  n;
+  int32_t i;
+
+  for (;;) {
+
+    pthread_mutex_lock(&pool->lock);
+    i=pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (i>=pool->count) break;
+    job=&pool->jobs[i];
+
+    /* keep the messages of the job until it is done, then show them */
+    /* all at once, so jobs running at the same time do not mix      */
+    if ((job->messages=tmpfile())==NULL) job->messages=pool->report;
+
+    job->size=fileSize(job->input);
+    start=wallClock();
+    job->status=pool->convert(job);
+    job->seconds=wallClock()-start;
+
+    if (job->messages!=pool->report) {
+
+      pthread_mutex_lock(&pool->output);
+      fprintf(pool->report,"[%s]\n",job->input);
+      rewind(job->messages);
+      while ((n=fread(buffer,1,sizeof(buffer),job->messages))>0)
+	fwrite(buffer,1,n,pool->report);
+      fflush(pool->report);
+      pthread_mutex_unlock(&pool->output);
+
+      fclose(job->messages);
+    }
+    job->messages=NULL;
+  }
+
+  return NULL;
+}
+
+
+
+/* write the stats kept by the jobs as one JSON array */
+int writeBatchStats(char *progname, const char *name, POOL *pool)
+{
+  FILE   *file = stdout;
+  JOB    *job;
+  int32_t i,count;
+
+  if (strcmp(name,"-") && (file=fopen(name,"w"))==NULL) {
+    fprintf(stderr,"%s: failed writing %s\n",progname,name);
+    return -1;
+  }
+
+  fprintf(file,"[\n");
+  for (count=i=0;i<pool->count;i++) {
+
+    job=&pool->jobs[i];
+    if (!job->measured) continue;
+
+    if (count++) fprintf(file,",\n");
+    writeStats(file,progname,job->input,job->output,job->status,&job->stats);
+  }
+  fprintf(file,"]\n");
+
+  if (file!=stdout) fclose(file);
+  return 0;
+}
+
+
+
+/* run all jobs in a list file or directory on a number of threads */
+int runBatch(char *progname, char *jobs, const char *from, const char *to,
+	     int threads, const char *stats, CONVERT convert)
+{
+  POOL       pool;
+  JOB       *job;
+  pthread_t *workers;
+  struct stat info;
+  double     start,seconds;
+  int64_t    total = 0;
+  int32_t    failed = 0;
+  int32_t    i;
+  int        j;
+
+  if (!stat(jobs,&info) && S_ISDIR(info.st_mode))
+    pool.jobs=findJobs(progname,jobs,from,to,&pool.count);
+  else
+    pool.jobs=readJobs(progname,jobs,from,to,&pool.count);
+
+  if (pool.jobs==NULL) {
+    fprintf(stderr,"%s: failed reading %s\n",progname,jobs);
+    return 1;
+  }
+
+  if (threads<=0) threads=cpuCount();
+  if (threads>pool.count) threads=pool.count;
+
+  pool.next=0;
+  pool.convert=convert;
+
+  /* stats written to the standard output are all that is written to it */
+  pool.report= stats!=NULL && !strcmp(stats,"-") ? stderr : stdout;
+  pthread_mutex_init(&pool.lock,NULL);
+  pthread_mutex_init(&pool.output,NULL);
+
+  workers=(pthread_t*)malloc((threads+1)*sizeof(pthread_t));
+  if (workers==NULL) { fprintf(stderr,"Not enough memory!\n"); exit(1); }
+
+  start=wallClock();
+
+  for (j=0;j<threads;j++)
+    if (pthread_create(&workers[j],NULL,runJobs,&pool)) break;
+
+  /* work on this thread as well if no thread could be started */
+  if (j==0) runJobs(&pool);
+  while (j--) pthread_join(workers[j],NULL);
+
+  seconds=wallClock()-start;
+
+  pthread_mutex_destroy(&pool.lock);
+  pthread_mutex_destroy(&pool.output);
+  free(workers);
+
+  /* show how each job did, and how fast it all went */
+  fprintf(pool.report,"\nstatus      size   seconds      MB/s  file\n");
+  for (i=0;i<pool.count;i++) {
+
+    job=&pool.jobs[i];
+    if (job->status)
+      fprintf(pool.report,"failed %9dK %9s %9s  %s\n",(int)(job->size/1024),
+	      "-","-",job->input);
+    else
+      fprintf(pool.report,"ok     %9dK %9.2f %9.1f  %s\n",
+	      (int)(job->size/1024),job->seconds,
+	      job->seconds>0 ? job->size/1e6/job->seconds : 0,job->input);
+
+    if (pool.jobs[i].status) failed++;
+    total+=pool.jobs[i].size;
+  }
+
+  fprintf(pool.report,
+	  "%d files, %d failed, %.1f MB in %.2f seconds (%.1f MB/s)\n",
+	  pool.count,failed,total/1e6,seconds,
+	  seconds>0 ? total/1e6/seconds : 0);
+
+  /* the jobs run at the same time, so their stats are written together */
+  if (stats!=NULL && writeBatchStats(progname,stats,&pool)) failed++;
+
+  for (i=0;i<pool.count;i++) {
+    free(pool.jobs[i].input);
+    free(pool.jobs[i].output);
+    for (j=1;j<pool.jobs[i].argc;j++) free(pool.jobs[i].argv[j]);
+    free(pool.jobs[i].argv);
+  }
+  free(pool.jobs);
+
+  return failed ? 1 : 0;
+}
+
+
+
+/* write the stats of a conversion as JSON */
+int saveStats(char *progname, const char *name, JOB *job, const char *input,
+	      const char *output, int status, STATS *stats, FILE *errors)
+{
+  FILE *file;
+
+  if (name==NULL) {
+    if (job!=NULL) { job->stats=*stats; job->measured=true; }
+    return 0;
+  }
+
+  if (!strcmp(name,"-")) {
+    writeStats(stdout,progname,input,output,status,stats);
+    fflush(stdout);
+    return 0;
+  }
+
+  if ((file=fopen(name,"w"))==NULL) {
+    fprintf(errors,"%s: failed writing %s\n",progname,name);
+    return -1;
+  }
+
+  writeStats(file,progname,input,output,status,stats);
+  fclose(file);
+
+  return 0;
+}
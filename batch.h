@@ -0,0 +1,68 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         batch.h                                                  */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Batch mode shared by the tools. A list of jobs (or all   */
+/*               files in a directory) is converted on a pool of threads, */
+/*               reporting the status and throughput of every file.       */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "castools.h"
+
+/* a conversion, read from a job list or found in a directory */
+typedef struct
+{
+  char    *input;
+  char    *output;       /* NULL if none is given */
+  int      argc;         /* options for this job only */
+  char   **argv;
+  FILE    *messages;     /* kept until the job is done */
+  int      status;       /* 0 if the conversion succeeded */
+  int64_t  size;         /* bytes in the input file */
+  double   seconds;
+  bool     measured;     /* stats are kept for the stats file of the batch */
+  STATS    stats;
+} JOB;
+
+/* convert the files of a job, returns 0 on success */
+typedef int (*CONVERT)(JOB *job);
+
+/* run all jobs in a list file or directory on a number of threads (0 for */
+/* all cpu's). Files in a directory need extension from, their output is */
+/* named after them with extension to (none if to is NULL). The stats    */
+/* kept by the jobs are written to file stats as one JSON array when all */
+/* jobs are done, unless stats is NULL. With - they are written to      */
+/* stdout and everything else is shown on stderr                        */
+int runBatch(char *progname, char *jobs, const char *from, const char *to,
+	     int threads, const char *stats, CONVERT convert);
+
+/* copy a string of a length */
+char *copyString(const char *string, size_t length);
+
+/* check the extension of a file name, in any case */
+int hasExtension(const char *name, const char *extension);
+
+/* write the stats of a conversion as JSON to a file, or to stdout if */
+/* the name is "-". Without a name a batch job keeps them for the     */
+/* stats file of the batch. Returns 0 on success                      */
+int saveStats(char *progname, const char *name, JOB *job, const char *input,
+	      const char *output, int status, STATS *stats, FILE *errors);
+
+#endif
@@ -0,0 +1,653 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         bench.c                                                  */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  This tool builds a corpus of synthetic tapes and decodes */
+/*               them again. The .cas files are modulated like cas2wav    */
+/*               does, resampled to several rates and formats and made    */
+/*               worse with noise, dc offset, wow and flutter, clipping   */
+/*               and phase inversion. The speed of the decoder and the    */
+/*               round trip accuracy are reported for every tape.         */
+/*               The tapes should decode to what the original wav2cas     */
+/*               decoded of them, with its default options and some       */
+/*               others, the run fails when one does not.                 */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "castools.h"
+
+/* sample rate of the modulated signal */
+#define MODULATOR_RATE    43200
+
+/* times each tape is decoded, the fastest time counts */
+#define REPEATS           3
+
+/* level of the noise, about 32 dB below the signal */
+#define NOISE_LEVEL       0.02
+
+/* size of the buffers samples are pulled in */
+#define BUFFER_SIZE       (1<<16)
+
+/* impairments of a tape */
+#define NOISE             0x01   /* white noise */
+#define DC                0x02   /* dc offset */
+#define WOW               0x04   /* slow and fast speed variations */
+#define CLIP              0x08   /* recorded too loud */
+#define INVERT            0x10   /* phase inverted */
+
+/* a tape of the corpus */
+typedef struct
+{
+  int  baudrate;
+  int  rate;
+  int  bits;
+  int  channels;
+  int  impairments;
+  int64_t  length;       /* of the .cas the original wav2cas decoded, */
+  uint64_t hash;         /* so a change in what is decoded is caught  */
+} TAPECASE;
+
+TAPECASE corpus[] =
+{
+  { 1200, 43200,  8, MONO,   0,                    3904, 0x67f579a5fae16674ULL },
+  { 2400, 43200,  8, MONO,   0,                    3904, 0x67f579a5fae16674ULL },
+  { 1200, 44100, 16, STEREO, 0,                    3904, 0x67f579a5fae16674ULL },
+  { 2400, 48000, 16, MONO,   0,                    3904, 0x67f579a5fae16674ULL },
+  { 1200, 96000, 16, STEREO, 0,                    3904, 0x67f579a5fae16674ULL },
+  { 2400, 96000,  8, MONO,   0,                    3904, 0x67f579a5fae16674ULL },
+  { 1200, 22050,  8, MONO,   0,                    3904, 0x67f579a5fae16674ULL },
+  { 1200, 44100, 16, MONO,   NOISE,                3904, 0x67f579a5fae16674ULL },
+  { 2400, 48000, 16, MONO,   NOISE,                3904, 0x67f579a5fae16674ULL },
+  { 1200, 44100,  8, MONO,   DC,                   3904, 0x67f579a5fae16674ULL },
+  { 2400, 44100, 16, STEREO, DC,                   3904, 0x67f579a5fae16674ULL },
+  { 1200, 44100, 16, MONO,   WOW,                  3904, 0x67f579a5fae16674ULL },
+  { 2400, 48000, 16, STEREO, WOW,                  3912, 0x5747b53c8ab31bb3ULL },
+  { 1200, 44100, 16, MONO,   CLIP,                    0, 0xcbf29ce484222325ULL },
+  { 2400, 48000,  8, MONO,   CLIP,                 3904, 0x67f579a5fae16674ULL },
+  { 1200, 44100, 16, MONO,   INVERT,               1097, 0x0d83318dc2f8a7caULL },
+  { 2400, 43200,  8, MONO,   INVERT,               3960, 0x4e79210d4d5aae97ULL },
+  { 1200, 48000, 16, STEREO, NOISE|DC|WOW|CLIP,       9, 0xb615e7cb111c4639ULL },
+  { 2400, 96000, 16, MONO,   NOISE|DC|WOW|INVERT,     0, 0xcbf29ce484222325ULL }
+};
+
+#define CASES ((int)(sizeof(corpus)/sizeof(corpus[0])))
+
+/* every tape is decoded by each demodulator */
+const char *engines[] = { "pulses", "tones" };
+
+#define ENGINES ((int)(sizeof(engines)/sizeof(engines[0])))
+
+/* the length and hash of the .cas data a tape decoded to */
+typedef struct
+{
+  int64_t  length;
+  uint64_t hash;
+} RESULT;
+
+/* options of the original wav2cas every tape is decoded with as well, */
+/* and what that should give, in the order of the corpus. It is what   */
+/* the original gave, except where noted for 2400-48000-16m-n: the     */
+/* silence is a duration since the -r option, 111 samples at 48000 Hz  */
+/* instead of the 100 of the original, and that noisy tape is right at */
+/* the edge of it                                                       */
+typedef struct
+{
+  const char *name;      /* as given to wav2cas */
+  bool  normalize;
+  bool  phase;
+  int   envelope;
+  bool  recover;
+  RESULT results[CASES];
+} OPTIONRUN;
+
+OPTIONRUN runs[] =
+{
+  { "-n",         true,  true,  2, false,
+    {
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3880, 0xb4cd235823b939e6ULL },  /* the original: 3904 bytes */
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3920, 0xa267574400f8266cULL },
+      {     0, 0xcbf29ce484222325ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  1097, 0x0d83318dc2f8a7caULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {     9, 0xb615e7cb111c4639ULL },
+      {     0, 0xcbf29ce484222325ULL }
+    } },
+  { "-p",         false, false, 2, false,
+    {
+      { 21817, 0x8790355632ee88c0ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {  1097, 0x0d83318dc2f8a7caULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      {   425, 0xf4b53c63273c0377ULL },
+      {  1017, 0xfa8e6ba699618d4bULL },
+      {   377, 0x5701cc6bc418db0fULL },
+      {    57, 0x3f28863eefc5b1d4ULL },
+      {    73, 0xc9e62186e888a575ULL },
+      {  1145, 0x56f62fe5ddc93fbfULL },
+      {  2057, 0xb41853fc11554347ULL },
+      {   393, 0x65b65d7c03af69c0ULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {     0, 0xcbf29ce484222325ULL },
+      {     0, 0xcbf29ce484222325ULL }
+    } },
+  { "-e 0",       false, true,  0, false,
+    {
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {     9, 0xb615a7cb111bd979ULL },
+      {     9, 0xb615adcb111be3abULL },  /* the original: 25 bytes */
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3944, 0x3d1fc63f0baf23cbULL },
+      {  3944, 0xbeaf536dbe21a833ULL },
+      {     0, 0xcbf29ce484222325ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  1097, 0x0d83318dc2f8a7caULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {     0, 0xcbf29ce484222325ULL },
+      {     0, 0xcbf29ce484222325ULL }
+    } },
+  { "-n -p -e 1", true,  false, 1, false,
+    {
+      { 21817, 0x8790355632ee88c0ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {   537, 0xc47c263c72086a3fULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      {   506, 0xaa95b70920fbcfcfULL },
+      {   985, 0xed09e54c816205d2ULL },
+      {  9593, 0x4279e50f1de120fbULL },  /* the original: 9481 bytes */
+      {   105, 0x906fb7b298b95638ULL },
+      {    58, 0xc38436c8e155ec6eULL },
+      {  1617, 0x7a35b41a83627234ULL },
+      {  2937, 0x8614118b7fc90071ULL },
+      {   537, 0xc47c263c72086a3fULL },
+      { 21833, 0x7b7eaf86a4bf4a87ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {    41, 0xd0e93010c58fb54aULL },
+      {     0, 0xcbf29ce484222325ULL }
+    } },
+  /* not in the original: it only reads what failed again, so it */
+  /* gives what the default options give on these tapes           */
+  { "-c",         false, true,  2, true,
+    {
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  3912, 0x5747b53c8ab31bb3ULL },
+      {     0, 0xcbf29ce484222325ULL },
+      {  3904, 0x67f579a5fae16674ULL },
+      {  1097, 0x0d83318dc2f8a7caULL },
+      {  3960, 0x4e79210d4d5aae97ULL },
+      {     9, 0xb615e7cb111c4639ULL },
+      {     0, 0xcbf29ce484222325ULL }
+    } }
+};
+
+#define RUNS ((int)(sizeof(runs)/sizeof(runs[0])))
+
+/* hash of .cas data (64 bit FNV-1a) */
+uint64_t hashData(const uint8_t *data, int64_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  while (size-->0) hash=(hash^*data++)*0x100000001b3ULL;
+
+  return hash;
+}
+
+
+
+/* a growing buffer */
+typedef struct
+{
+  uint8_t *data;
+  int64_t  length;
+  int64_t  size;
+} BUFFER;
+
+/* state of the random generator, the corpus is the same on every run */
+uint64_t seed = 0x2545F4914F6CDD1DULL;
+
+
+
+/* pseudo random number, 0 to 1 */
+double randomNumber(void)
+{
+  seed^=seed<<13; seed^=seed>>7; seed^=seed<<17;
+  return (seed>>11)*(1.0/9007199254740992.0);
+}
+
+
+
+/* gaussian noise, standard deviation of 1 */
+double randomNoise(void)
+{
+  double u = randomNumber();
+  double v = randomNumber();
+
+  return sqrt(-2*log(u+1e-300))*cos(2*M_PI*v);
+}
+
+
+
+/* add bytes to a buffer */
+void append(BUFFER *buffer, const void *data, int64_t length)
+{
+  if (length<=0) return;
+
+  if (buffer->length+length>buffer->size) {
+
+    buffer->size=2*(buffer->length+length);
+    if ((buffer->data=(uint8_t*)realloc(buffer->data,buffer->size))==NULL) {
+      fprintf(stderr,"Not enough memory!\n");
+      exit(1);
+    }
+  }
+
+  memcpy(buffer->data+buffer->length,data,length);
+  buffer->length+=length;
+}
+
+
+
+/* add a .cas header, headers always start at fixed positions */
+void appendHeader(BUFFER *cas)
+{
+  const uint8_t padding[8] = { 0 };
+
+  append(cas,padding,-cas->length&7);
+  append(cas,HEADER,8);
+}
+
+
+
+/* add a file block: the file type and name */
+void appendFile(BUFFER *cas, const char *type, const char *name)
+{
+  appendHeader(cas);
+  append(cas,type,10);
+  append(cas,name,6);
+}
+
+
+
+/* add random bytes, in a range of values */
+void appendRandom(BUFFER *cas, int64_t length, int low, int high)
+{
+  uint8_t byte;
+
+  while (length--) {
+    byte=low+(int)(randomNumber()*(high-low+1));
+    append(cas,&byte,1);
+  }
+}
+
+
+
+/* make the .cas data of a tape: a binary, a basic and an ascii file */
+void makeCas(BUFFER *cas)
+{
+  uint8_t address[6] = { 0x00,0x90, 0xff,0x97, 0x00,0x90 };
+  uint8_t eof = 0x1a;
+  int i;
+
+  appendFile(cas,BIN,"BINARY");
+  appendHeader(cas);
+  append(cas,address,6);
+  appendRandom(cas,2048,0,255);
+
+  appendFile(cas,BASIC,"PROGRM");
+  appendHeader(cas);
+  appendRandom(cas,1024,0,255);
+
+  /* ascii files are written in blocks of 256 bytes, the last one */
+  /* ends with the end of file mark                               */
+  appendFile(cas,ASCII,"TEXT  ");
+  for (i=0;i<3;i++) {
+    appendHeader(cas);
+    appendRandom(cas,i<2 ? 256 : 200,32,126);
+    if (i==2) while (cas->length&7) append(cas,&eof,1);
+  }
+}
+
+
+
+/* modulate .cas data like cas2wav does */
+void modulate(BUFFER *cas, int baudrate, BUFFER *signal)
+{
+  ENCODER_SETTINGS settings = ENCODER_DEFAULTS;
+  ENCODER *encoder;
+  uint8_t  buffer[BUFFER_SIZE];
+  int64_t  length;
+
+  settings.baudrate=baudrate;
+  encoder=encoderOpenMemory(cas->data,cas->length,&settings,NULL,NULL);
+  if (encoder==NULL) exit(1);
+
+  while ((length=encoderRead(encoder,buffer,BUFFER_SIZE))>0)
+    append(signal,buffer,length);
+
+  encoderClose(encoder);
+}
+
+
+
+/* store a sample in the format of the tape */
+void appendSample(BUFFER *wav, TAPECASE *tape, double value)
+{
+  uint8_t data[2];
+  int16_t sample;
+
+  if (value>1) value=1;
+  if (value<-1) value=-1;
+
+  if (tape->bits==8) {
+    data[0]=(uint8_t)(128+lrint(value*127));
+    append(wav,data,1);
+  } else {
+    sample=(int16_t)lrint(value*32767);
+    data[0]=sample&255; data[1]=(sample>>8)&255;
+    append(wav,data,2);
+  }
+}
+
+
+
+/* resample the modulated signal to the rate of the tape, with its */
+/* impairments, and store it as a wav file                          */
+void record(BUFFER *signal, TAPECASE *tape, BUFFER *wav)
+{
+  WAVE_HEADER header;
+  int64_t  frames,n,i;
+  int      c;
+  int      align = tape->channels*tape->bits/8;
+  double   t,position,fraction,value,level,duration;
+
+  /* the speed varies by 1% at 0.6 Hz (wow) and 0.3% at 9 Hz (flutter) */
+  double wow = tape->impairments&WOW ? 0.010 : 0;
+  double flutter = tape->impairments&WOW ? 0.003 : 0;
+
+  duration=(double)signal->length/MODULATOR_RATE;
+  frames=(int64_t)(duration*tape->rate)-2;
+
+  memcpy(header.RiffID,"RIFF",4);
+  memcpy(header.WaveID,"WAVE",4);
+  memcpy(header.FmtID,"fmt ",4);
+  memcpy(header.DataID,"data",4);
+  header.FmtSize=BIGENDIANLONG(16);
+  header.wFormatTag=BIGENDIANSHORT(PCM_WAVE_FORMAT);
+  header.nChannels=BIGENDIANSHORT(tape->channels);
+  header.nSamplesPerSec=BIGENDIANLONG(tape->rate);
+  header.nAvgBytesPerSec=BIGENDIANLONG(tape->rate*align);
+  header.nBlockAlign=BIGENDIANSHORT(align);
+  header.wBitsPerSample=BIGENDIANSHORT(tape->bits);
+  header.nDataBytes=BIGENDIANLONG(frames*align);
+  header.RiffSize=BIGENDIANLONG(frames*align+36);
+  append(wav,&header,sizeof(header));
+
+  /* too loud clips, the rest is recorded at a normal level */
+  level= tape->impairments&CLIP ? 3.0 : 0.8;
+  if (tape->impairments&INVERT) level=-level;
+
+  for (n=0;n<frames;n++) {
+
+    /* where the tape is, played at a varying speed */
+    t=(double)n/tape->rate;
+    position=t;
+    if (wow>0)
+      position+=wow/(2*M_PI*0.6)*(1-cos(2*M_PI*0.6*t))+
+		flutter/(2*M_PI*9)*(1-cos(2*M_PI*9*t));
+    position*=MODULATOR_RATE;
+
+    i=(int64_t)position;
+    fraction=position-i;
+    if (i+1>=signal->length) { i=signal->length-2; fraction=1; }
+
+    value=((1-fraction)*signal->data[i]+fraction*signal->data[i+1]-128)/127;
+    value*=level;
+
+    if (tape->impairments&DC) value+=0.2;
+
+    /* every channel has noise of its own */
+    for (c=0;c<tape->channels;c++)
+      appendSample(wav,tape,tape->impairments&NOISE ?
+		   value+NOISE_LEVEL*randomNoise() : value);
+  }
+}
+
+
+
+/* name of a tape, from its settings */
+void tapeName(TAPECASE *tape, char *name, size_t size)
+{
+  snprintf(name,size,"%d-%d-%d%s%s%s%s%s%s%s",
+	   tape->baudrate,tape->rate,tape->bits,
+	   tape->channels==MONO ? "m" : "s",
+	   tape->impairments ? "-" : "-clean",
+	   tape->impairments&NOISE ? "n" : "",
+	   tape->impairments&DC ? "d" : "",
+	   tape->impairments&WOW ? "w" : "",
+	   tape->impairments&CLIP ? "c" : "",
+	   tape->impairments&INVERT ? "i" : "");
+}
+
+
+
+/* write a file of the corpus */
+bool writeFile(const char *directory, const char *name, const char *extension,
+	       BUFFER *buffer)
+{
+  char  path[1024];
+  FILE *file;
+  bool  written;
+
+  snprintf(path,sizeof(path),"%s/%s%s",directory,name,extension);
+  if ((file=fopen(path,"wb"))==NULL) return false;
+  written=fwrite(buffer->data,1,buffer->length,file)==buffer->length;
+  fclose(file);
+
+  return written;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+  DECODER_SETTINGS settings = DECODER_DEFAULTS;
+  DECODER_SETTINGS options;
+  DECODER *decoder;
+  BUFFER   cas = { NULL, 0, 0 };
+  BUFFER   signal[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+  BUFFER   wav = { NULL, 0, 0 };
+  TAPECASE *tape;
+  const uint8_t *data;
+  char     name[64],path[1024];
+  int64_t  length,correct,frames;
+  int64_t  totalBytes[ENGINES] = { 0 }, totalFrames[ENGINES] = { 0 };
+  double   start,seconds,total[ENGINES] = { 0 };
+  int      exact[ENGINES] = { 0 };
+  int      expected[RUNS] = { 0 };
+  int      changed = 0;
+  int      i,e,r,o;
+  bool     same;
+
+  if (argc!=2) {
+    printf("usage: %s <directory>\n",argv[0]);
+    exit(1);
+  }
+
+  mkdir(argv[1],0777);
+
+  /* all tapes hold the same data, modulated at both baudrates */
+  makeCas(&cas);
+  modulate(&cas,1200,&signal[0]);
+  modulate(&cas,2400,&signal[1]);
+
+  printf("tape                     engine      bytes  seconds      MB/s"
+	 "  Msamples/s  correct  result\n");
+
+  for (i=0;i<CASES;i++) {
+
+    tape=&corpus[i];
+    tapeName(tape,name,sizeof(name));
+
+    wav.length=0;
+    record(&signal[tape->baudrate==2400],tape,&wav);
+
+    if (!writeFile(argv[1],name,".wav",&wav) ||
+	!writeFile(argv[1],name,".cas",&cas)) {
+      fprintf(stderr,"%s: failed writing %s/%s\n",argv[0],argv[1],name);
+      exit(1);
+    }
+
+    /* decode the tape the way wav2cas does, with each demodulator */
+    snprintf(path,sizeof(path),"%s/%s.wav",argv[1],name);
+    frames=(wav.length-sizeof(WAVE_HEADER))/(tape->channels*tape->bits/8);
+
+    for (e=0;e<ENGINES;e++) {
+
+      settings.engine= e ? DECODER_TONES : DECODER_PULSES;
+      decoder=NULL;
+      seconds=0;
+      for (r=0;r<REPEATS;r++) {
+
+	decoderClose(decoder);
+
+	start=wallClock();
+	decoder=decoderOpen(path,&settings,NULL,stderr);
+	if (decoder==NULL || decoderRun(decoder)) {
+	  fprintf(stderr,"%s: failed decoding %s\n",argv[0],path);
+	  exit(1);
+	}
+	start=wallClock()-start;
+	if (r==0 || start<seconds) seconds=start;
+      }
+
+      /* count the bytes that are where they should be */
+      data=decoderData(decoder,&length);
+      for (correct=0;correct<length && correct<cas.length;correct++)
+	if (data[correct]!=cas.data[correct]) break;
+
+      /* the pulses should still give what the original wav2cas gave */
+      same= e || (length==tape->length && hashData(data,length)==tape->hash);
+      if (!same) changed++;
+
+      printf("%-24s %-7s %9d %8.3f %9.1f %11.2f  %6.1f%%  %s%s\n",name,
+	     engines[e],(int)wav.length,seconds,
+	     seconds>0 ? wav.length/1e6/seconds : 0,
+	     seconds>0 ? frames/1e6/seconds : 0,
+	     100.0*correct/cas.length,
+	     length==cas.length && correct==cas.length ? "exact" : "DIFF",
+	     same ? "" : ", changed");
+
+      if (length==cas.length && correct==cas.length) exact[e]++;
+      totalBytes[e]+=wav.length;
+      totalFrames[e]+=frames;
+      total[e]+=seconds;
+
+      decoderClose(decoder);
+    }
+
+    /* and once with each set of options, with the pulses */
+    for (o=0;o<RUNS;o++) {
+
+      options=settings;
+      options.engine=DECODER_PULSES;
+      options.normalize=runs[o].normalize;
+      options.phase=runs[o].phase;
+      options.envelope=runs[o].envelope;
+      options.recover=runs[o].recover;
+
+      decoder=decoderOpen(path,&options,NULL,stderr);
+      if (decoder==NULL || decoderRun(decoder)) {
+	fprintf(stderr,"%s: failed decoding %s with %s\n",argv[0],path,
+		runs[o].name);
+	exit(1);
+      }
+
+      data=decoderData(decoder,&length);
+      if (length==runs[o].results[i].length &&
+	  hashData(data,length)==runs[o].results[i].hash)
+	expected[o]++;
+      else {
+	printf("%-24s %-7s changed\n",name,runs[o].name);
+	changed++;
+      }
+
+      decoderClose(decoder);
+    }
+  }
+
+  for (e=0;e<ENGINES;e++)
+    printf("%s: %d tapes, %d exact, %.1f MB in %.2f seconds "
+	   "(%.1f MB/s, %.2f Msamples/s)\n",
+	   engines[e],CASES,exact[e],totalBytes[e]/1e6,total[e],
+	   total[e]>0 ? totalBytes[e]/1e6/total[e] : 0,
+	   total[e]>0 ? totalFrames[e]/1e6/total[e] : 0);
+
+  for (o=0;o<RUNS;o++)
+    printf("%s: %d tapes, %d as expected\n",runs[o].name,CASES,expected[o]);
+
+  free(cas.data);
+  free(signal[0].data);
+  free(signal[1].data);
+  free(wav.data);
+
+  if (changed) {
+    fprintf(stderr,"%s: %d of the decodes changed\n",
+	    argv[0],changed);
+    return 1;
+  }
+
+  return 0;
+}
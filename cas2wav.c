@@ -23,320 +23,392 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <memory.h>
-#include <math.h>
+#include <string.h>
 
-#ifndef bool
-#define true   1
-#define false  0
-#define bool   int
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
 #endif
 
-/* CPU type defines */
-#if (BIGENDIAN)
-#define BIGENDIANSHORT(value)  ( ((value & 0x00FF) << 8) | \
-                                 ((value & 0xFF00) >>8 ) )
-#define BIGENDIANINT(value)    ( ((value & 0x000000FF) << 24) | \
-                                 ((value & 0x0000FF00) << 8)  | \
-                                 ((value & 0x00FF0000) >> 8)  | \
-                                 ((value & 0xFF000000) >> 24) )
-#define	BIGENDIANLONG(value)   BIGENDIANINT(value) // I suppose Long=int
-#else
-#define BIGENDIANSHORT(value) value
-#define BIGENDIANINT(value)   value
-#define	BIGENDIANLONG(value)  value
-#endif
-
-/* number of ouput bytes for silent parts */
-#define SHORT_SILENCE     OUTPUT_FREQUENCY    /* 1 second  */
-#define LONG_SILENCE      OUTPUT_FREQUENCY*2  /* 2 seconds */
+#include "castools.h"
+#include "batch.h"
 
-/* frequency for pulses */
-#define LONG_PULSE        1200
-#define SHORT_PULSE       2400
+/* size of the input and output buffers */
+#define BUFFER_SIZE       (1<<16)
 
-/* number of uint16_t pulses for headers */
-#define LONG_HEADER       16000
-#define SHORT_HEADER      4000
+/* default arguments */
+ENCODER_SETTINGS defaults = ENCODER_DEFAULTS;
+char *statsfile = NULL;
+bool  keepIndex = false;
+bool  showTimes = false;
 
-/* output settings */
-#define OUTPUT_FREQUENCY  43200
 
-/* default output baudrate */
-int BAUDRATE = 1200;
 
-/* headers definitions */
-char HEADER[8] = { 0x1F,0xA6,0xDE,0xBA,0xCC,0x13,0x7D,0x74 };
-char ASCII[10] = { 0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA };
-char BIN[10]   = { 0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0 };
-char BASIC[10] = { 0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3 };
+/* show a brief description */
+void showUsage(char *progname)
+{
+  int i;
 
-/* definitions for .wav file */
-#define PCM_WAVE_FORMAT   1
-#define MONO              1
-#define STEREO            2
+  printf("usage: %s [-2] [-i] [-p profile] [-s seconds] [-r rate] [-d bits]\n"
+         "          [-m stats] <ifile> <ofile|->\n"
+         "       %s -t [-p profile] <ifile>\n"
+         "       %s [options] [-j threads] -b <joblist|directory>\n"
+         " -2   use 2400 baud as output baudrate\n"
+         " -p   tape profile, one of:"
+	 ,progname,progname,progname);
 
-typedef struct
-{
-  char      RiffID[4];
-  uint32_t  RiffSize;
-  char      WaveID[4];
-  char      FmtID[4];
-  uint32_t  FmtSize;
-  uint16_t  wFormatTag;
-  uint16_t  nChannels;
-  uint32_t  nSamplesPerSec;
-  uint32_t  nAvgBytesPerSec;
-  uint16_t  nBlockAlign;
-  uint16_t  wBitsPerSample;
-  char      DataID[4];
-  uint32_t  nDataBytes;
-} WAVE_HEADER;
-
-WAVE_HEADER waveheader =
-{
-  { "RIFF" },
-  BIGENDIANLONG(0),
-  { "WAVE" },
-  { "fmt " },
-  BIGENDIANLONG(16),
-  BIGENDIANSHORT(PCM_WAVE_FORMAT),
-  BIGENDIANSHORT(MONO),
-  BIGENDIANLONG(OUTPUT_FREQUENCY),
-  BIGENDIANLONG(OUTPUT_FREQUENCY),
-  BIGENDIANSHORT(1),
-  BIGENDIANSHORT(8),
-  { "data" },
-  BIGENDIANLONG(0)
-};
-
-
-
-/* write a pulse */
-void writePulse(FILE *output,uint32_t f)
-{
-  uint32_t n;
-  double length = OUTPUT_FREQUENCY/(BAUDRATE*(f/1200));
-  double scale  = 2.0*M_PI/(double)length;
+  for (i=0;encoderProfileName(i);i++) printf(" %s",encoderProfileName(i));
 
-  for (n=0;n<(uint32_t)length;n++)
-    putc( (char)(sin((double)n*scale)*127)^128, output);
+  printf("\n"
+         "      or baud:long:short:longgap:shortgap, with the header pulses\n"
+         "      and the silences in milliseconds (default standard)\n"
+         " -t   show how long the tape plays with each profile\n"
+         " -s   define gap time (in seconds) between blocks (default 2)\n"
+         " -r   output sample rate (default %d)\n"
+         " -d   bits per sample, 8 or 16 (default %d)\n"
+         " -i   keep the blocks of the .cas file in an index file (ifile.idx)\n"
+         " -m   write counters and time per stage as JSON to a file, or with -\n"
+         "      as the only output on stdout (messages go to stderr then)\n"
+         " -b   convert all jobs in a list (lines of: ifile ofile [options])\n"
+         "      or all .cas files in a directory, on -j threads (default: all)\n"
+	 ,defaults.rate,defaults.bits);
 }
 
 
 
-/* write a header signal */
-void writeHeader(FILE *output,uint32_t s)
+/* parse command line options, returns false if they are invalid */
+bool parseOptions(int argc, char* argv[], ENCODER_SETTINGS *settings,
+		  char **ifile, char **ofile, char **batch, char **stats,
+		  FILE *errors)
 {
-  int  i;
-  for (i=0;i<s*(BAUDRATE/1200);i++) writePulse(output,SHORT_PULSE);
-}
-
+  int  i,j;
 
+  for (i=1; i<argc; i++) {
 
-/* write silence */
-void writeSilence(FILE *output,uint32_t s)
-{
-  int n;
-  for (n=0;n<s;n++) putc(128,output);
-}
+    /* a lone dash is the standard output */
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
 
+      for(j=1;j && argv[i][j]!='\0';j++) {
 
+        /* options with an argument need one */
+        if (strchr("sjbmrdp",argv[i][j]) && i+1>=argc) {
+          fprintf(errors,"%s: missing argument\n",argv[0]);
+          return false;
+        }
 
-/* write a byte */
-void writeByte(FILE *output,int byte)
-{
-  int  i;
-
-  /* one start bit */
-  writePulse(output,LONG_PULSE);
-
-  /* eight data bits */
-  for (i=0;i<8;i++) {
-    if (byte&1) {
-      writePulse(output,SHORT_PULSE);
-      writePulse(output,SHORT_PULSE);
-    } else writePulse(output,LONG_PULSE);
-    byte = byte >> 1;
-  }
+        switch(argv[i][j]) {
 
-  /* two stop bits */
-  for (i=0;i<4;i++) writePulse(output,SHORT_PULSE);
-}
+        case '2': settings->baudrate=2400; break;
+        case 's': settings->stime=atof(argv[++i]); j=-1; break;
+        case 'r': settings->rate=atoi(argv[++i]); j=-1; break;
+        case 'd': settings->bits=atoi(argv[++i]); j=-1; break;
+        case 'p':
+          if (encoderProfile(argv[++i],settings)) {
+            fprintf(errors,"%s: unknown profile %s\n",argv[0],argv[i]);
+            return false;
+          }
+          j=-1; break;
+        case 'j': settings->threads=atoi(argv[++i]); j=-1; break;
+        case 'm': settings->stats=true; *stats=argv[++i]; j=-1; break;
+        case 't':
+        case 'i':
+          if (batch==NULL) {
+            fprintf(errors,"%s: invalid option\n",argv[0]);
+            return false;
+          }
+          if (argv[i][j]=='t') showTimes=true;
+          else keepIndex=true;
+          break;
+        case 'b':
+          if (batch==NULL) {
+            fprintf(errors,"%s: invalid option\n",argv[0]);
+            return false;
+          }
+          *batch=argv[++i]; j=-1; break;
 
+        default:
+          fprintf(errors,"%s: invalid option\n",argv[0]);
+          return false;
+        }
+      }
 
+      continue;
+    }
 
-/* write data until a header is detected */
-void writeData(FILE* input,FILE* output,uint32_t *position,bool* eof)
-{
-  int  read;
-  int  i;
-  char buffer[8];
+    if (*ifile==NULL) { *ifile=argv[i]; continue; }
+    if (*ofile==NULL) { *ofile=argv[i]; continue; }
 
-  *eof=false;
-  while ((read=fread(buffer,1,8,input))==8) {
+    fprintf(errors,"%s: invalid option\n",argv[0]);
+    return false;
+  }
 
-    if (!memcmp(buffer,HEADER,8)) return;
+  /* stats written to the standard output are all that is written to it */
+  if (*stats!=NULL && !strcmp(*stats,"-") &&
+      (batch==NULL || (*ofile!=NULL && !strcmp(*ofile,"-")))) {
+    fprintf(errors,"%s: -m - can not be used with other output to -\n",
+	    argv[0]);
+    return false;
+  }
 
-    writeByte(output,buffer[0]);
-    if (buffer[0]==0x1a) *eof=true;
-    fseek(input,++*position,SEEK_SET);
+  /* the sample rate, bits and the timing of the profile */
+  if (!encoderCheck(settings,errors)) {
+    fprintf(errors,"%s: invalid settings\n",argv[0]);
+    return false;
   }
 
-  for (i=0;i<read;i++) writeByte(output,buffer[i]);
+  return true;
+}
+
 
-  if (buffer[0]==0x1a) *eof=true;
-  *position+=read;
 
-  return;
+/* the time a tape plays, -1 if it is not known */
+double playTime(ENCODER *encoder, ENCODER_SETTINGS *settings,
+		WAVE_HEADER *header)
+{
+  int64_t size = encoderSize(encoder,header);
+
+  if (size<0) return -1;
+  return (double)size/(settings->rate*(settings->bits/8));
 }
 
 
-/* show a brief description */
-void showUsage(char *progname)
+
+/* show a time as minutes and seconds */
+void showTime(FILE *stream, double seconds)
 {
-  printf("usage: %s [-2] [-s seconds] <ifile> <ofile>\n"
-         " -2   use 2400 baud as output baudrate\n"
-         " -s   define gap time (in seconds) between blocks (default 2)\n"
-	 ,progname);
+  fprintf(stream,"%d:%04.1f",(int)(seconds/60),seconds-60*(int)(seconds/60));
 }
 
 
 
-int main(int argc, char* argv[])
+/* show a number of a profile, pairs are shown as long/short */
+void showCount(int count, char separator)
 {
-  FILE *output,*input;
-  uint32_t size,position;
-  int  i,j;
-  int  stime = -1;
-  bool eof;
-  char buffer[10];
+  if (separator=='/') printf("%7d/",count);
+  else printf("%-7d ",count);
+}
 
-  char *ifile = NULL;
-  char *ofile = NULL;
 
-  /* parse command line options */
-  for (i=1; i<argc; i++) {
 
-    if (argv[i][0]=='-') {
+/* show how long a .cas file plays with each profile, and with the */
+/* settings given                                                   */
+int listTimes(char *progname, char *ifile, ENCODER_SETTINGS *settings)
+{
+  ENCODER_SETTINGS profile;
+  FILEDATA input;
+  ENCODER *encoder;
+  double   seconds;
+  int      i;
+
+  if (loadFile(ifile,&input)) {
+    fprintf(stderr,"%s: failed opening %s\n",progname,ifile);
+    return 1;
+  }
 
-      for(j=1;j && argv[i][j]!='\0';j++)
+  printf("profile   baud  headers          silences (ms)    time\n");
 
-        switch(argv[i][j]) {
+  for (i=-1;i==-1 || encoderProfileName(i);i++) {
 
-        case '2': BAUDRATE=2400; break;
-        case 's': stime=atof(argv[++i]); j=-1; break;
+    profile=*settings;
+    if (i>=0) encoderProfile(encoderProfileName(i),&profile);
 
-        default:
-          fprintf(stderr,"%s: invalid option\n",argv[0]);
-          exit(1);
-        }
+    if (profile.stime>0) profile.longSilence=1000*profile.stime;
+    encoderFillDefaults(&profile);
+
+    printf("%-8s  %4d  ",i>=0 ? encoderProfileName(i) : "selected",
+	   profile.baudrate);
+    showCount(profile.longHeader,'/');
+    showCount(profile.shortHeader,' ');
+    showCount(profile.longSilence,'/');
+    showCount(profile.shortSilence,' ');
 
+    /* a profile can need a higher sample rate than the one given */
+    if (!encoderCheck(&profile,NULL) ||
+	(encoder=encoderOpenMemory(input.data,input.size,&profile,NULL,
+				   NULL))==NULL) {
+      printf("invalid\n");
       continue;
     }
 
-    if (ifile==NULL) { ifile=argv[i]; continue; }
-    if (ofile==NULL) { ofile=argv[i]; continue; }
+    seconds=playTime(encoder,&profile,NULL);
+    encoderClose(encoder);
 
-    fprintf(stderr,"%s: invalid option\n",argv[0]);
-    exit(1);
+    showTime(stdout,seconds);
+    printf("\n");
   }
 
-  if (ifile==NULL || ofile==NULL) { showUsage(argv[0]); exit(1); }
+  unloadFile(&input);
+  return 0;
+}
 
-  /* open input/output files */
-  if ((input=fopen(ifile,"rb"))==NULL) {
-    fprintf(stderr,"%s: failed opening %s\n",argv[0],argv[1]);
-    exit(1);
+
+
+/* convert a .cas file to a wav file, returns 0 on success */
+int convertCas(char *progname, char *ifile, char *ofile, char *statsfile,
+	       JOB *job, ENCODER_SETTINGS *settings, FILE *messages,
+	       FILE *errors)
+{
+  FILE    *output;
+  FILEDATA input;
+  ENCODER *encoder;
+  CAS_BLOCK *blocks = NULL;
+  int64_t  count;
+  STATS   *stats;
+  TIMER    timer;
+  WAVE_HEADER header,final;
+  uint8_t  samples[BUFFER_SIZE];
+  int64_t  length;
+  double   start = wallClock();
+  double   loaded[2];
+  double   seconds;
+  int      status = 0;
+
+  /* the whole .cas file is mapped (or read) at once, the encoder finds */
+  /* all blocks in it before encoding, or they are taken from the index */
+  loaded[0]=wallClock(); loaded[1]=cpuClock();
+  if (loadFile(ifile,&input)) {
+    fprintf(errors,"%s: failed opening %s\n",progname,ifile);
+    return 1;
   }
 
-  if ((output=fopen(ofile,"wb"))==NULL) {
-    fprintf(stderr,"%s: failed writing %s\n",argv[0],argv[2]);
-    exit(1);
+  encoder=encoderOpenMemory(input.data,input.size,settings,messages,errors);
+  if (encoder==NULL) {
+    unloadFile(&input);
+    return 1;
   }
 
-  /* write initial .wav header */
-  fwrite(&waveheader,sizeof(waveheader),1,output);
+  if (keepIndex &&
+      (blocks=indexFile(ifile,input.data,input.size,&count))!=NULL)
+    encoderBlocks(encoder,blocks,count);
+
+  if ((stats=encoderStats(encoder))) {
+    stats->wall[STAGE_INGEST]+=wallClock()-loaded[0];
+    stats->cpu[STAGE_INGEST]+=cpuClock()-loaded[1];
+  }
+
+  /* the size of the samples is known before they are rendered, so the */
+  /* .wav header is right from the start and the output can be a pipe  */
+  startTimer(stats,&timer);
+  seconds=playTime(encoder,settings,&header);
+  stopTimer(stats,&timer,STAGE_SYNTHESIS);
+
+  fprintf(messages,"Writing %s, the tape plays ",ofile);
+  showTime(messages,seconds);
+  fprintf(messages,"\n");
+
+  if (!strcmp(ofile,"-")) output=stdout;
+  else if ((output=fopen(ofile,"wb"))==NULL) {
+    fprintf(errors,"%s: failed writing %s\n",progname,ofile);
+    unloadFile(&input);
+    encoderClose(encoder);
+    free(blocks);
+    return 1;
+  }
+
+  fwrite(&header,sizeof(header),1,output);
+
+  while ((length=encoderRead(encoder,samples,BUFFER_SIZE))>0) {
+    startTimer(stats,&timer);
+    fwrite(samples,1,length,output);
+    stopTimer(stats,&timer,STAGE_WRITE);
+  }
 
-  position=0;
-  /* search for a header in the .cas file */
-  while (fread(buffer,1,8,input)==8) {
+  /* the header only needs to be written again if the size was not right */
+  startTimer(stats,&timer);
+  encoderHeader(encoder,&final);
+  if (memcmp(&header,&final,sizeof(header))) {
+    if (fseek(output,0,SEEK_SET)) {
+      fprintf(errors,"%s: wrong size in the header of %s\n",progname,ofile);
+      status=1;
+    } else fwrite(&final,sizeof(final),1,output);
+    header=final;
+  }
 
-    if (!memcmp(buffer,HEADER,8)) {
+  if (output==stdout) fflush(output);
+  else fclose(output);
+  stopTimer(stats,&timer,STAGE_WRITE);
 
-      /* it probably works fine if a long header is used for every */
-      /* header but since the msx bios makes a distinction between */
-      /* them, we do also (hence a lot of code).                   */
+  if (stats) {
+    stats->written=sizeof(header)+BIGENDIANLONG(header.nDataBytes);
+    stats->elapsed=wallClock()-start;
+    status|=saveStats(progname,statsfile,job,ifile,ofile,status,stats,
+		      errors);
+  }
 
-      position+=8;
-      if (fread(buffer,1,10,input) == 10) {
+  encoderClose(encoder);
+  free(blocks);
+  unloadFile(&input);
 
-	if (!memcmp(buffer,ASCII,10)) {
+  return status ? 1 : 0;
+}
 
-	  fseek(input,position,SEEK_SET);
-	  writeSilence(output,stime>0?OUTPUT_FREQUENCY*stime:LONG_SILENCE);
-	  writeHeader(output,LONG_HEADER);
-	  writeData(input,output,&position,&eof);
 
-	  do {
 
-	    position+=8; fseek(input,position,SEEK_SET);
-	    writeSilence(output,SHORT_SILENCE);
-	    writeHeader(output,SHORT_HEADER);
-	    writeData(input,output,&position,&eof);
+/* convert the files of a batch job, with its own options */
+int convertJob(JOB *job)
+{
+  ENCODER_SETTINGS settings = defaults;
+  char *ifile = NULL;
+  char *ofile = NULL;
+  char *stats = NULL;
 
-	  } while (!eof && !feof(input));
+  if (!parseOptions(job->argc,job->argv,&settings,&ifile,&ofile,NULL,&stats,
+		    job->messages))
+    return 1;
 
-	}
-	else if (!memcmp(buffer,BIN,10) || !memcmp(buffer,BASIC,10)) {
+  if (ifile!=NULL || job->output==NULL) {
+    fprintf(job->messages,"%s: invalid job\n",job->argv[0]);
+    return 1;
+  }
 
-	  fseek(input,position,SEEK_SET);
-	  writeSilence(output,stime>0?OUTPUT_FREQUENCY*stime:LONG_SILENCE);
-	  writeHeader(output,LONG_HEADER);
-	  writeData(input,output,&position,&eof);
-	  writeSilence(output,SHORT_SILENCE);
-	  writeHeader(output,SHORT_HEADER);
-	  position+=8; fseek(input,position,SEEK_SET);
-	  writeData(input,output,&position,&eof);
+  /* without a -m of its own the stats go to the stats file of the batch */
+  return convertCas(job->argv[0],job->input,job->output,stats,job,&settings,
+		    job->messages,job->messages);
+}
 
-	} else {
 
-	  printf("unknown file type: using long header\n");
-	  fseek(input,position,SEEK_SET);
-	  writeSilence(output,LONG_SILENCE);
-	  writeHeader(output,LONG_HEADER);
-	  writeData(input,output,&position,&eof);
-	}
 
-      }
-      else {
+int main(int argc, char* argv[])
+{
+  char *ifile = NULL;
+  char *ofile = NULL;
+  char *batch = NULL;
 
-	printf("unknown file type: using long header\n");
-	fseek(input,position,SEEK_SET);
-	writeSilence(output,stime>0?OUTPUT_FREQUENCY*stime:LONG_SILENCE);
-	writeHeader(output,LONG_HEADER);
-	writeData(input,output,&position,&eof);
-      }
+  /* parse command line options */
+  if (!parseOptions(argc,argv,&defaults,&ifile,&ofile,&batch,&statsfile,
+		    stderr))
+    exit(1);
 
-    } else {
+  /* convert a list or directory of files, the options are the */
+  /* defaults for all jobs                                     */
+  if (batch!=NULL) {
 
-      /* should not occur */
-      fprintf(stderr,"skipping unhandled data\n");
-      position++;
-    }
+    if (ifile!=NULL || showTimes) { showUsage(argv[0]); exit(1); }
+    return runBatch(argv[0],batch,".cas",".wav",defaults.threads,statsfile,
+		    convertJob);
+  }
 
-    fseek(input,position,SEEK_SET);
+  if (showTimes) {
+    if (ifile==NULL || ofile!=NULL) { showUsage(argv[0]); exit(1); }
+    return listTimes(argv[0],ifile,&defaults);
   }
 
-  /* write final .wav header */
-  size = ftell(output)-sizeof(waveheader);
-  waveheader.nDataBytes = BIGENDIANLONG(size);
-  waveheader.RiffSize = BIGENDIANLONG(size);
-  fseek(output,0,SEEK_SET);
-  fwrite(&waveheader,sizeof(waveheader),1,output);
+  if (ifile==NULL || ofile==NULL) { showUsage(argv[0]); exit(1); }
 
-  fclose(output);
-  fclose(input);
+  /* samples written to the standard output are not mixed with messages */
+  if (!strcmp(ofile,"-")) {
+    #ifdef _WIN32
+    setmode(fileno(stdout),O_BINARY);
+    #endif
+    return convertCas(argv[0],ifile,ofile,statsfile,NULL,&defaults,stderr,
+		      stderr);
+  }
 
-  return 0;
+  /* and neither are stats */
+  if (statsfile!=NULL && !strcmp(statsfile,"-"))
+    return convertCas(argv[0],ifile,ofile,statsfile,NULL,&defaults,stderr,
+		      stderr);
+
+  return convertCas(argv[0],ifile,ofile,statsfile,NULL,&defaults,stdout,
+		    stderr);
 }
@@ -21,118 +21,782 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <memory.h>
-
-char HEADER[8] = { 0x1F,0xA6,0xDE,0xBA,0xCC,0x13,0x7D,0x74 };
-char ASCII[10] = { 0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA };
-char BIN[10]   = { 0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0 };
-char BASIC[10] = { 0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3 };
-
-enum next {
-  NEXT_NONE,
-  NEXT_ASCII,
-  NEXT_BINARY,
-  NEXT_DATA
-};
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
-int main(int argc, char* argv[])
+#include "castools.h"
+#include "batch.h"
+
+#ifdef _WIN32
+#define lstat stat
+#endif
+
+/* keep the blocks of each .cas file in an index file */
+bool keepIndex = false;
+
+/* show the files found so far */
+void showEntries(CATALOG *catalog, FILE *output)
 {
-  FILE *ifile;
-  union {
-    uint8_t data[10];
-    struct binary_header_t {
-      uint16_t start, stop, exec;
-    } binary_header;
-  } buffer;
-  char filename[6];
-  long position;
-  int  next = NEXT_NONE;
-
-  if (argc != 2) {
-    
-    printf("usage: %s <ifile>\n",argv[0]);
-    exit(0);
+  CAS_ENTRY entry;
+
+  while (catalogNext(catalog,&entry)) {
+
+    switch (entry.type) {
+
+      case CAS_ASCII:
+	fprintf(output,"%.6s  ascii\n",entry.name);
+	break;
+
+      case CAS_BASIC:
+	fprintf(output,"%.6s  basic\n",entry.name);
+	break;
+
+      case CAS_BINARY:
+	fprintf(output,"%.6s  binary  %.4x,%.4x,%.4x\n",entry.name,
+		entry.start,entry.stop,entry.exec);
+	break;
+
+      default:
+	fprintf(output,"------  custom  %.6x\n",(int)entry.offset);
+	break;
+    }
   }
-  
-  if ( (ifile = fopen(argv[1],"rb")) == NULL) {
+}
+
+
+
+/* list the contents of a .cas file, returns 0 on success */
+int listCas(char *progname, char *name, FILE *output, FILE *errors)
+{
+  FILEDATA input;
+  CATALOG *catalog;
+  CAS_BLOCK *blocks = NULL;
+  int64_t  count;
+
+  /* the whole .cas file is mapped (or read) at once, and listed from */
+  /* header to header                                                  */
+  if (loadFile(name,&input)) {
+
+    fprintf(errors,"%s: failed opening %s\n",progname,name);
+    return 1;
+  }
+
+  if ((catalog=catalogOpenMemory(input.data,input.size))==NULL) {
+
+    fprintf(errors,"Not enough memory!\n");
+    unloadFile(&input);
+    return 1;
+  }
+
+  if (keepIndex &&
+      (blocks=indexFile(name,input.data,input.size,&count))!=NULL)
+    catalogBlocks(catalog,blocks,count);
+
+  showEntries(catalog,output);
+
+  catalogClose(catalog);
+  free(blocks);
+  unloadFile(&input);
+ 
+  return 0;
+}
+
+
+
+/* list the contents of a batch job, in its output file if it has one */
+int listJob(JOB *job)
+{
+  FILE *output;
+  int   status;
 
-    fprintf(stderr,"%s: failed opening %s\n",argv[0],argv[1]);
+  if (job->argc>1) {
+    fprintf(job->messages,"%s: invalid job\n",job->argv[0]);
+    return 1;
+  }
+
+  if (job->output==NULL)
+    return listCas(job->argv[0],job->input,job->messages,job->messages);
+
+  if ((output=fopen(job->output,"w"))==NULL) {
+    fprintf(job->messages,"%s: failed writing %s\n",job->argv[0],job->output);
+    return 1;
+  }
+
+  status=listCas(job->argv[0],job->input,output,job->messages);
+  fclose(output);
+
+  return status;
+}
+
+
+
+/* catalog of a directory tree, kept in a cache file in it by default */
+#define CACHE_NAME        ".casdir"
+#define CACHE_MAGIC       "# casdir catalog 1\n"
+
+/* longest line in a cache file */
+#define LINE_SIZE         8192
+
+/* catalog output formats */
+enum {
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+/* a file on the tape, with the size and hash of its blocks */
+typedef struct
+{
+  CAS_ENTRY entry;
+  int64_t   size;        /* from its first header up to the next file */
+  uint64_t  hash;
+} ITEM;
+
+/* a .cas file in a catalog */
+typedef struct
+{
+  char     *path;
+  int64_t   size;
+  int64_t   mtime;
+  uint64_t  hash;        /* of the whole file */
+  ITEM     *items;
+  int32_t   count;
+  bool      cached;      /* taken from the cache, not read again */
+  int       status;      /* 0 if it could be read */
+} CASFILE;
+
+/* the .cas files of a catalog, read by a pool of threads */
+typedef struct
+{
+  CASFILE  *files;
+  int32_t   count;
+  int32_t   allocated;
+  int32_t   next;        /* first file not taken by a thread */
+  char     *progname;
+  pthread_mutex_t lock;
+} COLLECTION;
+
+
+
+/* hash of .cas data (64 bit FNV-1a) */
+uint64_t hashData(const uint8_t *data, int64_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  while (size-->0) hash=(hash^*data++)*0x100000001b3ULL;
+
+  return hash;
+}
+
+
+
+/* a file name in a directory */
+char *joinPath(const char *directory, const char *name)
+{
+  char *path;
+
+  if ((path=(char*)malloc(strlen(directory)+strlen(name)+2))==NULL) {
+    fprintf(stderr,"Not enough memory!\n");
     exit(1);
   }
 
-  position=0;
-  while (fread(&buffer,1,8,ifile)==8) {
-    
-    position += 8;
-
-    if (!memcmp(&buffer,HEADER,8)) {
-      
-      switch (next) {
-
-	case NEXT_NONE:
-	default:
-          if (fread(&buffer,1,10,ifile)==10) {
-	    if (!memcmp(&buffer,ASCII,10)) {
-	      
-	      fread(filename,1,6,ifile); next=NEXT_ASCII;
-	      printf("%.6s  ascii\n",filename);
-	      position += 16;
-	    } 
-      
-	    else if (!memcmp(&buffer,BIN,10)) {
-	      
-	      fread(filename,1,6,ifile); next=NEXT_BINARY;
-	      position += 16;
-	    }
-
-	    else if (!memcmp(&buffer,BASIC,10)) {
-	      
-	      fread(filename,1,6,ifile); next=NEXT_DATA;
-	      printf("%.6s  basic\n", filename);
-	      position += 16;
-	    }
-      
-	    else {
-
-	      printf("------  custom  %.6x\n",(int)position);
-	      fseek(ifile, -2, SEEK_CUR);
-	      position += 8;
-	    }
-	  }
-	  break;
-
-	case NEXT_ASCII:
-	  while (fread(&buffer,1,8,ifile) == 8 &&
-	         memchr(&buffer, 0x1a, 8) == NULL)
-	    position += 8;
-	  position += 8;
-
-	  next = NEXT_NONE;
-	  break;
-
-	case NEXT_BINARY:
-	  if (fread(&buffer,1,8,ifile)==8) {
-	    if (!buffer.binary_header.exec)
-	       buffer.binary_header.exec=buffer.binary_header.start;
-
-	    printf("%.6s  binary  %.4x,%.4x,%.4x\n",filename,
-	    		buffer.binary_header.start,
-	    		buffer.binary_header.stop,
-	    		buffer.binary_header.exec);
-	    position += 8;
-	    next=NEXT_NONE;
-	  }
-	  break;
-
-	case NEXT_DATA:
-	  next=NEXT_NONE;
-	  break;
+  sprintf(path,"%s/%s",directory,name);
+  return path;
+}
+
+
+
+/* add a file to a collection, the path is kept by it */
+CASFILE *addFile(COLLECTION *collection, char *path)
+{
+  CASFILE *file;
+
+  if (collection->count==collection->allocated) {
+    collection->allocated= collection->allocated ? 2*collection->allocated:256;
+    collection->files=(CASFILE*)realloc(collection->files,
+					collection->allocated*sizeof(CASFILE));
+    if (collection->files==NULL) {
+      fprintf(stderr,"Not enough memory!\n");
+      exit(1);
+    }
+  }
+
+  file=&collection->files[collection->count++];
+  memset(file,0,sizeof(CASFILE));
+  file->path=path;
+
+  return file;
+}
+
+
+
+/* add a file on the tape to a .cas file */
+ITEM *addItem(CASFILE *file, int32_t *allocated)
+{
+  if (file->count==*allocated) {
+    *allocated= *allocated ? 2**allocated : 16;
+    if ((file->items=(ITEM*)realloc(file->items,*allocated*sizeof(ITEM)))
+	==NULL) {
+      fprintf(stderr,"Not enough memory!\n");
+      exit(1);
+    }
+  }
+
+  memset(&file->items[file->count],0,sizeof(ITEM));
+  return &file->items[file->count++];
+}
+
+
+
+/* order files on their path */
+int compareFiles(const void *a, const void *b)
+{
+  return strcmp(((const CASFILE*)a)->path,((const CASFILE*)b)->path);
+}
+
+
+
+/* find all .cas files in a directory and the directories in it. Links to */
+/* directories are not followed, so the walk can not go round in circles  */
+void findFiles(COLLECTION *collection, const char *name)
+{
+  DIR     *dir;
+  struct dirent *entry;
+  struct stat info;
+  CASFILE *file;
+  char    *path;
+
+  if ((dir=opendir(name))==NULL) {
+    fprintf(stderr,"%s: failed opening %s\n",collection->progname,name);
+    return;
+  }
+
+  while ((entry=readdir(dir))!=NULL) {
+
+    if (!strcmp(entry->d_name,".") || !strcmp(entry->d_name,"..")) continue;
+    path=joinPath(name,entry->d_name);
+
+    if (lstat(path,&info)==0 && S_ISDIR(info.st_mode))
+      findFiles(collection,path);
+
+    else if (hasExtension(entry->d_name,".cas") &&
+	     stat(path,&info)==0 && S_ISREG(info.st_mode)) {
+      file=addFile(collection,path);
+      file->size=info.st_size;
+      file->mtime=info.st_mtime;
+      continue;
+    }
+
+    free(path);
+  }
+
+  closedir(dir);
+}
+
+
+
+/* split a cache line at tabs, the last field takes the rest of the line */
+int splitFields(char *line, char **fields, int size)
+{
+  int count = 0;
+
+  while (count<size-1) {
+    fields[count++]=line;
+    if ((line=strchr(line,'\t'))==NULL) return count;
+    *line++='\0';
+  }
+
+  fields[count++]=line;
+  return count;
+}
+
+
+
+/* value of a hex digit */
+int hexValue(char digit)
+{
+  if (digit>='a' && digit<='f') return digit-'a'+10;
+  if (digit>='A' && digit<='F') return digit-'A'+10;
+  return digit>='0' && digit<='9' ? digit-'0' : 0;
+}
+
+
+
+/* read a cache file, every file in it up to the first damaged line */
+void readCache(COLLECTION *cache, const char *name)
+{
+  FILE    *stream;
+  CASFILE *file = NULL;
+  ITEM    *item;
+  char     line[LINE_SIZE];
+  char    *fields[10];
+  int32_t  expected = 0;
+  int32_t  allocated = 0;
+  size_t   length;
+  int      i;
+
+  if ((stream=fopen(name,"r"))==NULL) return;
+
+  if (fgets(line,sizeof(line),stream)==NULL || strcmp(line,CACHE_MAGIC)) {
+    fclose(stream);
+    return;
+  }
+
+  while (fgets(line,sizeof(line),stream)) {
+
+    length=strlen(line);
+    if (length==0 || line[length-1]!='\n') break;
+    line[length-1]='\0';
+
+    /* a file: size, time, hash, number of files on the tape and path */
+    if (line[0]=='F' && (file==NULL || file->count==expected) &&
+	splitFields(line,fields,6)==6) {
+
+      file=addFile(cache,copyString(fields[5],strlen(fields[5])));
+      file->size=strtoll(fields[1],NULL,10);
+      file->mtime=strtoll(fields[2],NULL,10);
+      file->hash=strtoull(fields[3],NULL,16);
+      expected=atoi(fields[4]);
+      allocated=0;
+      continue;
+    }
+
+    /* a file on the tape: type, name, addresses, offsets, size and hash */
+    if (line[0]=='E' && file && file->count<expected &&
+	splitFields(line,fields,10)==10 && strlen(fields[2])==12) {
+
+      item=addItem(file,&allocated);
+      item->entry.type=atoi(fields[1]);
+      for (i=0;i<6;i++)
+	item->entry.name[i]=hexValue(fields[2][2*i])<<4|hexValue(fields[2][2*i+1]);
+      item->entry.start=strtol(fields[3],NULL,16);
+      item->entry.stop=strtol(fields[4],NULL,16);
+      item->entry.exec=strtol(fields[5],NULL,16);
+      item->entry.offset=strtoll(fields[6],NULL,10);
+      item->entry.header=strtoll(fields[7],NULL,10);
+      item->size=strtoll(fields[8],NULL,10);
+      item->hash=strtoull(fields[9],NULL,16);
+      continue;
+    }
+
+    break;
+  }
+
+  fclose(stream);
+
+  /* a file that is cut short is read again */
+  if (file && file->count!=expected) {
+    free(file->path);
+    free(file->items);
+    cache->count--;
+  }
+
+  if (cache->count) qsort(cache->files,cache->count,sizeof(CASFILE),
+			 compareFiles);
+}
+
+
+
+/* write a cache file, in place of the old one once it is complete */
+void writeCache(COLLECTION *collection, const char *name)
+{
+  FILE    *stream;
+  CASFILE *file;
+  ITEM    *item;
+  char    *temporary = joinPath(name,"");
+  int32_t  i,j;
+  int      k;
+
+  /* the name ends with a slash now, make it a temporary file */
+  temporary[strlen(temporary)-1]='~';
+
+  if ((stream=fopen(temporary,"w"))==NULL) {
+    fprintf(stderr,"%s: failed writing %s\n",collection->progname,name);
+    free(temporary);
+    return;
+  }
+
+  fputs(CACHE_MAGIC,stream);
+
+  for (i=0;i<collection->count;i++) {
+
+    file=&collection->files[i];
+    if (file->status) continue;
+
+    fprintf(stream,"F\t%lld\t%lld\t%016llx\t%d\t%s\n",(long long)file->size,
+	    (long long)file->mtime,(unsigned long long)file->hash,
+	    (int)file->count,file->path);
+
+    for (j=0;j<file->count;j++) {
+
+      item=&file->items[j];
+      fprintf(stream,"E\t%d\t",item->entry.type);
+      for (k=0;k<6;k++)
+	fprintf(stream,"%.2x",(unsigned char)item->entry.name[k]);
+      fprintf(stream,"\t%.4x\t%.4x\t%.4x\t%lld\t%lld\t%lld\t%016llx\n",
+	      item->entry.start,item->entry.stop,item->entry.exec,
+	      (long long)item->entry.offset,(long long)item->entry.header,
+	      (long long)item->size,(unsigned long long)item->hash);
+    }
+  }
+
+  if (fclose(stream) || rename(temporary,name)) {
+    fprintf(stderr,"%s: failed writing %s\n",collection->progname,name);
+    remove(temporary);
+  }
+
+  free(temporary);
+}
+
+
+
+/* read the files on the tape of a .cas file, returns 0 on success */
+int readCas(char *progname, CASFILE *file)
+{
+  FILEDATA  input;
+  CATALOG  *catalog;
+  CAS_BLOCK *blocks = NULL;
+  CAS_ENTRY entry;
+  ITEM     *item;
+  int64_t   count,end;
+  int32_t   allocated = 0;
+  int32_t   i;
+
+  if (loadFile(file->path,&input)) {
+    fprintf(stderr,"%s: failed opening %s\n",progname,file->path);
+    return 1;
+  }
+
+  if ((catalog=catalogOpenMemory(input.data,input.size))==NULL) {
+    fprintf(stderr,"Not enough memory!\n");
+    unloadFile(&input);
+    return 1;
+  }
+
+  if (keepIndex &&
+      (blocks=indexFile(file->path,input.data,input.size,&count))!=NULL)
+    catalogBlocks(catalog,blocks,count);
+
+  while (catalogNext(catalog,&entry)) {
+    item=addItem(file,&allocated);
+    item->entry=entry;
+  }
+
+  /* the blocks of a file go up to the next file */
+  for (i=0;i<file->count;i++) {
+    item=&file->items[i];
+    end= i+1<file->count ? item[1].entry.header : input.size;
+    item->size=end-item->entry.header;
+    item->hash=hashData(input.data+item->entry.header,item->size);
+  }
+
+  file->size=input.size;
+  file->hash=hashData(input.data,input.size);
+
+  catalogClose(catalog);
+  free(blocks);
+  unloadFile(&input);
+
+  return 0;
+}
+
+
+
+/* catalog thread, takes files until all are taken */
+void *readFiles(void *arg)
+{
+  COLLECTION *collection = (COLLECTION*)arg;
+  CASFILE    *file;
+  int32_t     i;
+
+  for (;;) {
+
+    pthread_mutex_lock(&collection->lock);
+    i=collection->next++;
+    pthread_mutex_unlock(&collection->lock);
+
+    if (i>=collection->count) break;
+
+    file=&collection->files[i];
+    if (!file->cached) file->status=readCas(collection->progname,file);
+  }
+
+  return NULL;
+}
+
+
+
+/* type of a file on the tape */
+const char *typeName(int type)
+{
+  switch (type) {
+    case CAS_ASCII:  return "ascii";
+    case CAS_BINARY: return "binary";
+    case CAS_BASIC:  return "basic";
+    default:         return "custom";
+  }
+}
+
+
+
+/* name of a file on the tape, with anything that can not be shown as a dot */
+void entryName(const CAS_ENTRY *entry, char *name)
+{
+  int i;
+
+  for (i=0;i<6 && entry->type!=CAS_CUSTOM && entry->name[i];i++)
+    name[i]= entry->name[i]>=0x20 && entry->name[i]<0x7f ? entry->name[i]:'.';
+
+  name[i]='\0';
+}
+
+
+
+/* write a string as a CSV value */
+void writeCsv(FILE *stream, const char *string)
+{
+  putc('"',stream);
+
+  for (;*string;string++) {
+    if (*string=='"') putc('"',stream);
+    putc(*string,stream);
+  }
+
+  putc('"',stream);
+}
+
+
+
+/* show a catalog as text, CSV or JSON */
+void showCatalog(COLLECTION *collection, int format, FILE *output)
+{
+  CASFILE *file;
+  ITEM    *item;
+  char     name[7];
+  char     where[16];
+  int32_t  i,j;
+  bool     first = true;
+
+  if (format==FORMAT_CSV)
+    fprintf(output,"path,file_size,file_hash,type,name,start,stop,exec,"
+		   "offset,header,size,hash\n");
+  if (format==FORMAT_JSON) fprintf(output,"[");
+
+  for (i=0;i<collection->count;i++) {
+
+    file=&collection->files[i];
+    if (file->status) continue;
+
+    if (format==FORMAT_TEXT) fprintf(output,"%s\n",file->path);
+
+    if (format==FORMAT_CSV && file->count==0) {
+      writeCsv(output,file->path);
+      fprintf(output,",%lld,%016llx,,,,,,,,,\n",(long long)file->size,
+	      (unsigned long long)file->hash);
+    }
+
+    if (format==FORMAT_JSON) {
+      fprintf(output,"%s\n  { \"path\": ",first ? "" : ",");
+      writeJson(output,file->path);
+      fprintf(output,", \"size\": %lld, \"mtime\": %lld, \"hash\": \"%016llx\",\n"
+		     "    \"files\": [",(long long)file->size,
+	      (long long)file->mtime,(unsigned long long)file->hash);
+      first=false;
+    }
+
+    for (j=0;j<file->count;j++) {
+
+      item=&file->items[j];
+      entryName(&item->entry,name);
+
+      switch (format) {
+
+      case FORMAT_TEXT:
+	where[0]='\0';
+	if (item->entry.type==CAS_BINARY)
+	  sprintf(where,"%.4x,%.4x,%.4x",item->entry.start,item->entry.stop,
+		  item->entry.exec);
+	if (item->entry.type==CAS_CUSTOM)
+	  sprintf(where,"%.6x",(int)item->entry.offset);
+
+	fprintf(output,"  %-6s  %-6s  %-14s  %10lld  %016llx\n",
+		item->entry.type==CAS_CUSTOM ? "------" : name,
+		typeName(item->entry.type),where,(long long)item->size,
+		(unsigned long long)item->hash);
+	break;
+
+      case FORMAT_CSV:
+	writeCsv(output,file->path);
+	fprintf(output,",%lld,%016llx,%s,",(long long)file->size,
+		(unsigned long long)file->hash,typeName(item->entry.type));
+	writeCsv(output,name);
+	fprintf(output,",%d,%d,%d,%lld,%lld,%lld,%016llx\n",
+		item->entry.start,item->entry.stop,item->entry.exec,
+		(long long)item->entry.offset,(long long)item->entry.header,
+		(long long)item->size,(unsigned long long)item->hash);
+	break;
+
+      case FORMAT_JSON:
+	fprintf(output,"%s\n      { \"type\": \"%s\", \"name\": ",
+		j ? "," : "",typeName(item->entry.type));
+	writeJson(output,name);
+	fprintf(output,", \"start\": %d, \"stop\": %d, \"exec\": %d,\n"
+		       "        \"offset\": %lld, \"header\": %lld, "
+		       "\"size\": %lld, \"hash\": \"%016llx\" }",
+		item->entry.start,item->entry.stop,item->entry.exec,
+		(long long)item->entry.offset,(long long)item->entry.header,
+		(long long)item->size,(unsigned long long)item->hash);
+	break;
       }
     }
+
+    if (format==FORMAT_JSON) fprintf(output,"%s] }",file->count ? "\n    " : "");
+  }
+
+  if (format==FORMAT_JSON) fprintf(output,"%s]\n",first ? "" : "\n");
+}
+
+
+
+/* list all .cas files in a directory tree. Files that have the same size */
+/* and time as in the cache are not read again. Returns 0 on success      */
+int listCatalog(char *progname, char *directory, char *name, char *format,
+		int threads)
+{
+  COLLECTION collection;
+  COLLECTION cache;
+  CASFILE   *file,*known;
+  pthread_t *workers;
+  char      *path = name ? name : joinPath(directory,CACHE_NAME);
+  int32_t    i,read = 0,failed = 0;
+  int        j,kind;
+
+  if (!strcmp(format,"text")) kind=FORMAT_TEXT;
+  else if (!strcmp(format,"csv")) kind=FORMAT_CSV;
+  else if (!strcmp(format,"json")) kind=FORMAT_JSON;
+  else {
+    fprintf(stderr,"%s: invalid format %s\n",progname,format);
+    return 1;
+  }
+
+  memset(&collection,0,sizeof(COLLECTION));
+  memset(&cache,0,sizeof(COLLECTION));
+  collection.progname=cache.progname=progname;
+
+  findFiles(&collection,directory);
+  if (collection.count)
+    qsort(collection.files,collection.count,sizeof(CASFILE),compareFiles);
+
+  readCache(&cache,path);
+
+  /* take what is known of files that did not change */
+  for (i=0;i<collection.count;i++) {
+
+    file=&collection.files[i];
+    /* an empty cache has no files to look in */
+    known= cache.count ? (CASFILE*)bsearch(file,cache.files,cache.count,
+					   sizeof(CASFILE),compareFiles) : NULL;
+
+    if (known && known->size==file->size && known->mtime==file->mtime) {
+      file->hash=known->hash;
+      file->items=known->items;
+      file->count=known->count;
+      file->cached=true;
+      known->items=NULL;
+    } else read++;
+  }
+
+  /* read the others on a pool of threads */
+  if (threads<=0) threads=cpuCount();
+  if (threads>read) threads=read;
+
+  pthread_mutex_init(&collection.lock,NULL);
+  workers=(pthread_t*)malloc((threads+1)*sizeof(pthread_t));
+
+  for (j=0;j<threads;j++)
+    if (pthread_create(&workers[j],NULL,readFiles,&collection)) break;
+  if (j==0) readFiles(&collection);
+  while (j>0) pthread_join(workers[--j],NULL);
+
+  free(workers);
+  pthread_mutex_destroy(&collection.lock);
+
+  for (i=0;i<collection.count;i++)
+    if (collection.files[i].status) failed++;
+
+  showCatalog(&collection,kind,stdout);
+  if (kind==FORMAT_TEXT)
+    printf("%d files, %d read, %d from the cache, %d failed\n",
+	   (int)collection.count,(int)(read-failed),
+	   (int)(collection.count-read),(int)failed);
+
+  /* the cache only changes if a file was added, changed or removed */
+  if (read || collection.count!=cache.count) writeCache(&collection,path);
+
+  for (i=0;i<collection.count;i++) {
+    free(collection.files[i].path);
+    free(collection.files[i].items);
+  }
+  for (i=0;i<cache.count;i++) {
+    free(cache.files[i].path);
+    free(cache.files[i].items);
+  }
+  free(collection.files);
+  free(cache.files);
+  if (name==NULL) free(path);
+
+  return failed ? 1 : 0;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+  char *ifile   = NULL;
+  char *batch   = NULL;
+  char *tree    = NULL;
+  char *cache   = NULL;
+  char *format  = "text";
+  int   threads = 0;
+  int   i;
+
+  /* list a single file, all jobs in a list or directory, or a catalog */
+  /* of a directory tree                                               */
+  for (i=1; i<argc; i++) {
+
+    if (!strcmp(argv[i],"-i")) keepIndex=true;
+    else if (!strcmp(argv[i],"-b") && i+1<argc) batch=argv[++i];
+    else if (!strcmp(argv[i],"-r") && i+1<argc) tree=argv[++i];
+    else if (!strcmp(argv[i],"-c") && i+1<argc) cache=argv[++i];
+    else if (!strcmp(argv[i],"-f") && i+1<argc) format=argv[++i];
+    else if (!strcmp(argv[i],"-j") && i+1<argc) threads=atoi(argv[++i]);
+    else if (argv[i][0]!='-' && !ifile) ifile=argv[i];
+    else { ifile=batch=tree=NULL; break; }
   }
+
+  if (ifile != NULL && !batch && !tree)
+    return listCas(argv[0],ifile,stdout,stderr);
+
+  if (tree != NULL && !ifile && !batch)
+    return listCatalog(argv[0],tree,cache,format,threads);
+
+  if (batch == NULL || ifile || tree) {
     
-  fclose(ifile);
- 
-  return 0;
+    printf("usage: %s [-i] <ifile>\n"
+	   "       %s [-i] [-j threads] -b <joblist|directory>\n"
+	   "       %s [-i] [-j threads] [-c cache] [-f format] -r <directory>\n"
+	   " -i   keep the blocks of each .cas file in an index file (ifile.idx)\n"
+	   " -b   list all jobs in a list (lines of: ifile [ofile])\n"
+	   "      or all .cas files in a directory, on -j threads (default: all)\n"
+	   " -r   catalog all .cas files in a directory and below, on -j threads\n"
+	   " -c   cache of the catalog (default: directory/%s)\n"
+	   " -f   catalog format: text, csv or json (default: text)\n",
+	   argv[0],argv[0],argv[0],CACHE_NAME);
+    exit(0);
+  }
+
+  return runBatch(argv[0],batch,".cas",NULL,threads,NULL,listJob);
 }
 
@@ -0,0 +1,343 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         casindex.c                                               */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Block index of the castools library. Finds all headers   */
+/*               in .cas data in one (vectorized) scan, and keeps the     */
+/*               index in a file next to the .cas file so it is only      */
+/*               made again when the .cas file changes.                   */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "castools.h"
+
+/* vectorized search, build with -DNOSIMD for the plain C version only */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(NOSIMD)
+#include <immintrin.h>
+#define SIMD
+#endif
+
+/* index files are named after the .cas file */
+#define INDEX_EXTENSION   ".idx"
+
+/* index files start with this, followed by the size and time of the */
+/* .cas file, the number of blocks and the offset and type of each   */
+#define INDEX_MAGIC       "CASINDEX"
+#define INDEX_HEADER      32
+#define INDEX_ENTRY       9
+
+/* index files are little endian, read and write them byte by byte */
+#define GETLONG(p)  ( (uint32_t)((p)[0] | ((p)[1]<<8) | ((p)[2]<<16) | \
+			         ((uint32_t)(p)[3]<<24)) )
+#define GETQUAD(p)  ( (uint64_t)GETLONG(p) | ((uint64_t)GETLONG((p)+4)<<32) )
+
+
+
+/* find the next header from position on, -1 if there is none */
+int64_t nextHeader(const uint8_t *data, int64_t size, int64_t position)
+{
+  const uint8_t *found;
+
+  while (size-position>=8) {
+
+    found=(const uint8_t*)memchr(data+position,HEADER[0],size-position-7);
+    if (found==NULL) break;
+
+    position=found-data;
+    if (!memcmp(found,HEADER,8)) return position;
+    position++;
+  }
+
+  return -1;
+}
+
+
+
+#ifdef SIMD
+
+/* SSE2: 16 positions at a time, only those that start with the first */
+/* two bytes of a header are compared completely                      */
+int64_t nextHeaderSSE2(const uint8_t *data, int64_t size, int64_t position)
+{
+  __m128i  first  = _mm_set1_epi8(HEADER[0]);
+  __m128i  second = _mm_set1_epi8(HEADER[1]);
+  uint32_t mask;
+  int64_t  found;
+
+  for (;position+16+8<=size;position+=16) {
+
+    mask=_mm_movemask_epi8(
+	   _mm_and_si128(
+	     _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data+position)),
+			    first),
+	     _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data+position+1)),
+			    second)));
+
+    for (;mask;mask&=mask-1) {
+      found=position+__builtin_ctz(mask);
+      if (!memcmp(data+found,HEADER,8)) return found;
+    }
+  }
+
+  return nextHeader(data,size,position);
+}
+
+
+
+/* AVX2: 32 positions at a time */
+__attribute__((target("avx2")))
+int64_t nextHeaderAVX2(const uint8_t *data, int64_t size, int64_t position)
+{
+  __m256i  first  = _mm256_set1_epi8(HEADER[0]);
+  __m256i  second = _mm256_set1_epi8(HEADER[1]);
+  uint32_t mask;
+  int64_t  found;
+
+  for (;position+32+8<=size;position+=32) {
+
+    mask=_mm256_movemask_epi8(
+	   _mm256_and_si256(
+	     _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data+position)),
+			       first),
+	     _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data+position+1)),
+			       second)));
+
+    for (;mask;mask&=mask-1) {
+      found=position+__builtin_ctz(mask);
+      if (!memcmp(data+found,HEADER,8)) return found;
+    }
+  }
+
+  return nextHeaderSSE2(data,size,position);
+}
+
+#endif
+
+/* the search used, picked once for the cpu that runs it */
+int64_t (*headerKernel)(const uint8_t*,int64_t,int64_t) = nextHeader;
+pthread_once_t searchPicked = PTHREAD_ONCE_INIT;
+
+
+
+/* pick the fastest search the cpu supports */
+void selectSearch(void)
+{
+#ifdef SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2")) headerKernel=nextHeaderSSE2;
+  if (__builtin_cpu_supports("avx2")) headerKernel=nextHeaderAVX2;
+#endif
+}
+
+
+
+/* add a block to an index */
+CAS_BLOCK *addBlock(CAS_BLOCK *blocks, int64_t *count, int64_t *allocated,
+		    int64_t offset, int type)
+{
+  CAS_BLOCK *grown;
+
+  if (*count==*allocated) {
+    *allocated= *allocated ? 2**allocated : 256;
+    grown=(CAS_BLOCK*)realloc(blocks,*allocated*sizeof(CAS_BLOCK));
+    if (grown==NULL) { free(blocks); return NULL; }
+    blocks=grown;
+  }
+
+  blocks[*count].offset=offset;
+  blocks[*count].type=type;
+  (*count)++;
+
+  return blocks;
+}
+
+
+
+/* the data of a block ends at the next header */
+void endBlocks(CAS_BLOCK *blocks, int64_t count, int64_t size)
+{
+  int64_t i;
+
+  for (i=0;i<count;i++)
+    blocks[i].end= i+1<count ? blocks[i+1].offset : size;
+}
+
+
+
+/* find the blocks of .cas data in one scan. A header can be anywhere, */
+/* not only at the positions it is written at                          */
+CAS_BLOCK *indexBlocks(const uint8_t *data, int64_t size, int64_t *count)
+{
+  CAS_BLOCK *blocks = NULL;
+  int64_t    allocated = 0;
+  int64_t    position = 0;
+
+  pthread_once(&searchPicked,selectSearch);
+
+  *count=0;
+
+  while ((position=headerKernel(data,size,position))>=0) {
+
+    blocks=addBlock(blocks,count,&allocated,position,
+		    casType(data+position+8,size-position-8));
+    if (blocks==NULL) return NULL;
+
+    /* the header does not overlap with itself */
+    position+=8;
+  }
+
+  /* always return a table, also for data without headers */
+  if (blocks==NULL) return (CAS_BLOCK*)malloc(sizeof(CAS_BLOCK));
+
+  endBlocks(blocks,*count,size);
+  return blocks;
+}
+
+
+
+/* store a number in an index file */
+void putQuad(uint8_t *p, uint64_t value)
+{
+  int i;
+
+  for (i=0;i<8;i++) p[i]=(value>>(8*i))&255;
+}
+
+
+
+/* name of the index file of a .cas file */
+char *indexName(const char *name)
+{
+  char *index;
+
+  if ((index=(char*)malloc(strlen(name)+sizeof(INDEX_EXTENSION)))==NULL)
+    return NULL;
+
+  strcpy(index,name);
+  strcat(index,INDEX_EXTENSION);
+
+  return index;
+}
+
+
+
+/* read an index file, NULL if there is none or it is not of this file */
+CAS_BLOCK *readIndex(const char *index, struct stat *info, int64_t *count)
+{
+  CAS_BLOCK *blocks;
+  FILE      *file;
+  uint8_t    header[INDEX_HEADER];
+  uint8_t    entry[INDEX_ENTRY];
+  int64_t    i,size,offset,last = -8;
+
+  if ((file=fopen(index,"rb"))==NULL) return NULL;
+
+  if (fread(header,1,INDEX_HEADER,file)!=INDEX_HEADER ||
+      memcmp(header,INDEX_MAGIC,8) ||
+      (int64_t)GETQUAD(header+8)!=(int64_t)info->st_size ||
+      (int64_t)GETQUAD(header+16)!=(int64_t)info->st_mtime) {
+    fclose(file);
+    return NULL;
+  }
+
+  size=info->st_size;
+  *count=GETQUAD(header+24);
+
+  if (*count<0 || *count>size/8 ||
+      (blocks=(CAS_BLOCK*)malloc((*count+1)*sizeof(CAS_BLOCK)))==NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  /* headers are in order and do not overlap */
+  for (i=0;i<*count;i++) {
+
+    if (fread(entry,1,INDEX_ENTRY,file)!=INDEX_ENTRY ||
+	(offset=GETQUAD(entry))<last+8 || offset+8>size || entry[8]>CAS_CUSTOM) {
+      free(blocks);
+      fclose(file);
+      return NULL;
+    }
+
+    blocks[i].offset=last=offset;
+    blocks[i].type=entry[8];
+  }
+
+  fclose(file);
+
+  endBlocks(blocks,*count,size);
+  return blocks;
+}
+
+
+
+/* write an index file, a partly written one is never used */
+void writeIndex(const char *index, struct stat *info, CAS_BLOCK *blocks,
+		int64_t count)
+{
+  FILE    *file;
+  uint8_t  header[INDEX_HEADER];
+  uint8_t  entry[INDEX_ENTRY];
+  int64_t  i;
+  bool     written;
+
+  if ((file=fopen(index,"wb"))==NULL) return;
+
+  memcpy(header,INDEX_MAGIC,8);
+  putQuad(header+8,info->st_size);
+  putQuad(header+16,info->st_mtime);
+  putQuad(header+24,count);
+  written= fwrite(header,1,INDEX_HEADER,file)==INDEX_HEADER;
+
+  for (i=0;written && i<count;i++) {
+    putQuad(entry,blocks[i].offset);
+    entry[8]=blocks[i].type;
+    written= fwrite(entry,1,INDEX_ENTRY,file)==INDEX_ENTRY;
+  }
+
+  if (fclose(file) || !written) remove(index);
+}
+
+
+
+/* the blocks of a .cas file, from its index file while the .cas file has */
+/* the same size and time. Otherwise the data is indexed and the index    */
+/* file is written again                                                  */
+CAS_BLOCK *indexFile(const char *name, const uint8_t *data, int64_t size,
+		     int64_t *count)
+{
+  CAS_BLOCK  *blocks = NULL;
+  struct stat info;
+  char       *index = indexName(name);
+  bool        known;
+
+  known= index!=NULL && stat(name,&info)==0 && info.st_size==size;
+
+  if (known) blocks=readIndex(index,&info,count);
+
+  if (blocks==NULL) {
+    blocks=indexBlocks(data,size,count);
+    if (blocks && known) writeIndex(index,&info,blocks,*count);
+  }
+
+  free(index);
+  return blocks;
+}
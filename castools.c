@@ -0,0 +1,300 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         castools.c                                               */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Definitions and helpers shared by the decoder, encoder   */
+/*               and catalog of the castools library.                     */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#define MMAP
+#endif
+
+#include "castools.h"
+
+/* headers definitions */
+const char HEADER[8] = { 0x1F,0xA6,0xDE,0xBA,0xCC,0x13,0x7D,0x74 };
+const char ASCII[10] = { 0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA };
+const char BIN[10]   = { 0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0 };
+const char BASIC[10] = { 0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3 };
+
+
+
+/* number of cpu's to keep busy */
+int cpuCount(void)
+{
+  #ifdef _SC_NPROCESSORS_ONLN
+  long count=sysconf(_SC_NPROCESSORS_ONLN);
+  if (count>0) return count;
+  #endif
+  return 1;
+}
+
+
+
+/* show a message, nothing is shown if the stream is NULL */
+void logMessage(FILE *stream, const char *format, ...)
+{
+  va_list args;
+
+  if (stream==NULL) return;
+
+  va_start(args,format);
+  vfprintf(stream,format,args);
+  va_end(args);
+}
+
+
+
+/* map a whole file, or read it if it can not be mapped */
+int loadFile(const char *name, FILEDATA *file)
+{
+  FILE *input;
+
+  memset(file,0,sizeof(FILEDATA));
+  if ((input=fopen(name,"rb"))==NULL) return -1;
+
+  fseek(input,0,SEEK_END);
+  file->size=ftell(input);
+  fseek(input,0,SEEK_SET);
+
+  #ifdef MMAP
+  if (file->size>0) {
+    file->data=(uint8_t*)mmap(NULL,file->size,PROT_READ,MAP_PRIVATE,
+			      fileno(input),0);
+    if (file->data==MAP_FAILED) file->data=NULL;
+    else {
+      madvise(file->data,file->size,MADV_SEQUENTIAL);
+      file->mapped=true;
+      fclose(input);
+      return 0;
+    }
+  }
+  #endif
+
+  if ((file->data=(uint8_t*)malloc(file->size+1))==NULL ||
+      (int64_t)fread(file->data,1,file->size,input)!=file->size) {
+    free(file->data);
+    file->data=NULL;
+    fclose(input);
+    return -1;
+  }
+
+  fclose(input);
+  return 0;
+}
+
+
+
+/* release a file loaded by loadFile */
+void unloadFile(FILEDATA *file)
+{
+  #ifdef MMAP
+  if (file->mapped) munmap(file->data,file->size);
+  else
+  #endif
+  free(file->data);
+
+  file->data=NULL;
+}
+
+
+
+/* add data, dropping what is looked at already. Returns 0 on success, */
+/* -1 if the data can not grow                                         */
+int pushData(CASDATA *cas, const uint8_t *data, int64_t size)
+{
+  uint8_t *grown;
+  int64_t  drop,allocated;
+
+  /* data of the caller can not grow */
+  if (cas->finished || (cas->data && !cas->allocated)) return -1;
+
+  drop= cas->position<cas->size ? cas->position : cas->size;
+  if (drop>0) {
+    memmove(cas->data,cas->data+drop,cas->size-drop);
+    cas->size-=drop;
+    cas->position-=drop;
+    cas->base+=drop;
+  }
+
+  if (cas->size+size>cas->allocated) {
+
+    allocated= 2*(cas->size+size)<4096 ? 4096 : 2*(cas->size+size);
+    if ((grown=(uint8_t*)realloc(cas->data,allocated))==NULL) return -1;
+    cas->data=grown;
+    cas->allocated=allocated;
+  }
+
+  memcpy(cas->data+cas->size,data,size);
+  cas->size+=size;
+
+  return 0;
+}
+
+
+
+/* check if there are count bytes to look at, or there never will be */
+bool haveData(CASDATA *cas, int64_t count)
+{
+  return cas->finished || cas->size-cas->position>=count;
+}
+
+
+
+/* the type of the file that follows a header */
+int casType(const uint8_t *data, int64_t available)
+{
+  if (available<10) return CAS_CUSTOM;
+
+  if (!memcmp(data,ASCII,10)) return CAS_ASCII;
+  if (!memcmp(data,BIN,10)) return CAS_BINARY;
+  if (!memcmp(data,BASIC,10)) return CAS_BASIC;
+
+  return CAS_CUSTOM;
+}
+
+
+
+/* wall clock time in seconds */
+double wallClock(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return now.tv_sec+now.tv_nsec/1e9;
+}
+
+
+
+/* cpu time of the calling thread in seconds */
+double cpuClock(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&now);
+  return now.tv_sec+now.tv_nsec/1e9;
+}
+
+
+
+/* start timing a stage */
+void startTimer(STATS *stats, TIMER *timer)
+{
+  if (stats==NULL) return;
+
+  timer->wall=wallClock();
+  timer->cpu=cpuClock();
+}
+
+
+
+/* add the time since startTimer to a stage */
+void stopTimer(STATS *stats, TIMER *timer, int stage)
+{
+  if (stats==NULL) return;
+
+  stats->wall[stage]+=wallClock()-timer->wall;
+  stats->cpu[stage]+=cpuClock()-timer->cpu;
+}
+
+
+
+/* add the counters and times of one conversion to another */
+void addStats(STATS *total, const STATS *stats)
+{
+  int i;
+
+  for (i=0;i<STAGES;i++) {
+    total->wall[i]+=stats->wall[i];
+    total->cpu[i]+=stats->cpu[i];
+  }
+
+  total->samples+=stats->samples;
+  total->pulses+=stats->pulses;
+  total->probes+=stats->probes;
+  total->headers+=stats->headers;
+  total->bytes+=stats->bytes;
+  total->failures+=stats->failures;
+  total->silences+=stats->silences;
+  total->skipped+=stats->skipped;
+  total->recovered+=stats->recovered;
+  total->written+=stats->written;
+}
+
+
+
+/* write a string as a JSON value */
+void writeJson(FILE *stream, const char *string)
+{
+  putc('"',stream);
+
+  for (;string && *string;string++) {
+
+    if (*string=='"' || *string=='\\') fprintf(stream,"\\%c",*string);
+    else if ((unsigned char)*string<0x20)
+      fprintf(stream,"\\u%04x",(unsigned char)*string);
+    else putc(*string,stream);
+  }
+
+  putc('"',stream);
+}
+
+
+
+/* write stats as a JSON object */
+void writeStats(FILE *stream, const char *tool, const char *input,
+		const char *output, int status, const STATS *stats)
+{
+  const char *stages[STAGES] =
+    { "ingest", "normalize", "envelope", "decode", "synthesis", "write" };
+  int i;
+
+  fprintf(stream,"{\n  \"tool\": ");
+  writeJson(stream,tool);
+  fprintf(stream,",\n  \"input\": ");
+  writeJson(stream,input);
+  fprintf(stream,",\n  \"output\": ");
+  writeJson(stream,output);
+  fprintf(stream,",\n  \"status\": %d,\n",status);
+  fprintf(stream,"  \"elapsed\": %.6f,\n",stats->elapsed);
+
+  fprintf(stream,"  \"stages\": {\n");
+  for (i=0;i<STAGES;i++)
+    fprintf(stream,"    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f }%s\n",
+	    stages[i],stats->wall[i],stats->cpu[i],i<STAGES-1 ? "," : "");
+  fprintf(stream,"  },\n");
+
+  fprintf(stream,"  \"counters\": {\n");
+  fprintf(stream,"    \"samples\": %lld,\n",(long long)stats->samples);
+  fprintf(stream,"    \"pulses\": %lld,\n",(long long)stats->pulses);
+  fprintf(stream,"    \"header_probes\": %lld,\n",(long long)stats->probes);
+  fprintf(stream,"    \"headers\": %lld,\n",(long long)stats->headers);
+  fprintf(stream,"    \"bytes\": %lld,\n",(long long)stats->bytes);
+  fprintf(stream,"    \"byte_failures\": %lld,\n",(long long)stats->failures);
+  fprintf(stream,"    \"silences\": %lld,\n",(long long)stats->silences);
+  fprintf(stream,"    \"headerless\": %lld,\n",(long long)stats->skipped);
+  fprintf(stream,"    \"recovered\": %lld,\n",(long long)stats->recovered);
+  fprintf(stream,"    \"written\": %lld\n",(long long)stats->written);
+  fprintf(stream,"  }\n}\n");
+}
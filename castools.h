@@ -0,0 +1,425 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         castools.h                                               */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  The castools library. Decoding .wav samples to .cas      */
+/*               data, encoding .cas data to .wav samples and listing     */
+/*               .cas contents, each on a context of its own so any       */
+/*               number of them can run in one program. Data is pushed    */
+/*               in and pulled out in buffers of any size.                */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef CASTOOLS_H
+#define CASTOOLS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef bool
+#define true   1
+#define false  0
+#define bool   int
+#endif
+
+/* CPU type defines */
+#if (BIGENDIAN)
+#define BIGENDIANSHORT(value)  ( ((value & 0x00FF) << 8) | \
+                                 ((value & 0xFF00) >>8 ) )
+#define BIGENDIANINT(value)    ( ((value & 0x000000FF) << 24) | \
+                                 ((value & 0x0000FF00) << 8)  | \
+                                 ((value & 0x00FF0000) >> 8)  | \
+                                 ((value & 0xFF000000) >> 24) )
+#define	BIGENDIANLONG(value)   BIGENDIANINT(value) // I suppose Long=int
+#else
+#define BIGENDIANSHORT(value) value
+#define BIGENDIANINT(value)   value
+#define	BIGENDIANLONG(value)  value
+#endif
+
+/* definitions for .wav file */
+#define PCM_WAVE_FORMAT   1
+#define MONO              1
+#define STEREO            2
+
+typedef struct
+{
+  char      RiffID[4];
+  uint32_t  RiffSize;
+  char      WaveID[4];
+  char      FmtID[4];
+  uint32_t  FmtSize;
+  uint16_t  wFormatTag;
+  uint16_t  nChannels;
+  uint32_t  nSamplesPerSec;
+  uint32_t  nAvgBytesPerSec;
+  uint16_t  nBlockAlign;
+  uint16_t  wBitsPerSample;
+  char      DataID[4];
+  uint32_t  nDataBytes;
+} WAVE_HEADER;
+
+/* headers definitions */
+extern const char HEADER[8];
+extern const char ASCII[10];
+extern const char BIN[10];
+extern const char BASIC[10];
+
+/* number of cpu's to keep busy */
+int cpuCount(void);
+
+/* show a message, nothing is shown if the stream is NULL */
+void logMessage(FILE *stream, const char *format, ...);
+
+/* a whole file in memory */
+typedef struct
+{
+  uint8_t *data;
+  int64_t  size;
+  bool     mapped;       /* mapped, not read */
+} FILEDATA;
+
+/* map a whole file, or read it if it can not be mapped. Returns 0 on */
+/* success                                                             */
+int  loadFile(const char *name, FILEDATA *file);
+void unloadFile(FILEDATA *file);
+
+
+
+/**************************************************************************/
+/* stats                                                                  */
+/**************************************************************************/
+
+/* stages of a conversion that are timed */
+enum {
+  STAGE_INGEST,          /* reading and converting samples */
+  STAGE_NORMALIZE,       /* finding the peak level */
+  STAGE_ENVELOPE,        /* envelope correction */
+  STAGE_DECODE,          /* measuring pulses, finding headers and bytes */
+  STAGE_SYNTHESIS,       /* rendering samples */
+  STAGE_WRITE,           /* writing the output */
+  STAGES
+};
+
+/* counters and time per stage of a conversion. Stages running on more */
+/* threads add up the time of all threads                               */
+typedef struct
+{
+  double   wall[STAGES]; /* seconds */
+  double   cpu[STAGES];
+  double   elapsed;      /* wall clock time of the whole conversion */
+  int64_t  samples;      /* samples read or rendered */
+  int64_t  pulses;       /* pulses measured */
+  int64_t  probes;       /* runs of pulses tried as header */
+  int64_t  headers;      /* headers found */
+  int64_t  bytes;        /* bytes decoded or encoded */
+  int64_t  failures;     /* bytes that could not be read */
+  int64_t  silences;     /* silences skipped */
+  int64_t  skipped;      /* stretches of data without a header */
+  int64_t  recovered;    /* bytes read again from those stretches */
+  int64_t  written;      /* bytes of output */
+} STATS;
+
+/* time taken by a stage, from startTimer to stopTimer */
+typedef struct
+{
+  double   wall;
+  double   cpu;
+} TIMER;
+
+/* wall clock and cpu time of the calling thread, in seconds */
+double wallClock(void);
+double cpuClock(void);
+
+/* time a stage, nothing is done if stats is NULL */
+void startTimer(STATS *stats, TIMER *timer);
+void stopTimer(STATS *stats, TIMER *timer, int stage);
+
+/* add the counters and times of one conversion to another */
+void addStats(STATS *total, const STATS *stats);
+
+/* write a string as a JSON value */
+void writeJson(FILE *stream, const char *string);
+
+/* write stats as a JSON object */
+void writeStats(FILE *stream, const char *tool, const char *input,
+		const char *output, int status, const STATS *stats);
+
+
+
+/**************************************************************************/
+/* decoder (wav2cas)                                                      */
+/**************************************************************************/
+
+/* demodulators */
+enum {
+  DECODER_PULSES,        /* measure the width of each pulse */
+  DECODER_TONES          /* correlate each bit with both tones */
+};
+
+/* what is decoded of a stereo recording */
+enum {
+  DECODER_RIGHT,         /* the last channel */
+  DECODER_LEFT,          /* the first channel */
+  DECODER_SUM,           /* both channels added */
+  DECODER_DIFFERENCE,    /* the last channel taken from the first */
+  DECODER_SOURCES
+};
+
+typedef struct
+{
+  int   threshold;       /* amplitude threshold  */
+  int   envelope;        /* envelope correction  */
+  bool  normalize;       /* amplitude normalize  */
+  bool  phase;           /* phase shift */
+  float window;          /* window factor */
+  int   threads;         /* decoding threads, 0 to decode in one go */
+  int   rate;            /* decoding sample rate, 0 for the rate of the file */
+  bool  sweep;           /* try a range of settings and keep the best */
+  bool  stats;           /* keep counters and time the stages */
+  int   engine;          /* demodulator, DECODER_PULSES or DECODER_TONES */
+  bool  recover;         /* read what could not be read again with other */
+                         /* settings, not for sweeps and streams          */
+  int   sources;         /* of a stereo recording, decoded on a thread each */
+                         /* and merged per block: 1 the last channel, 2    */
+                         /* both channels, 4 also their sum and difference */
+} DECODER_SETTINGS;
+
+/* default arguments */
+#define DECODER_DEFAULTS  { 5, 2, false, true, 1.5, 0, 0, false, false, \
+			    DECODER_PULSES, false, 1 }
+
+/* highest envelope level, a quarter of the window on the samples */
+#define DECODER_MAX_ENVELOPE  (1<<18)
+
+typedef struct DECODER DECODER;
+
+/* what is reported while decoding, see decoderEvents */
+enum {
+  DECODER_HEADER,        /* a header is found */
+  DECODER_BLOCK          /* a block is read, its data can be pulled now */
+};
+
+typedef struct
+{
+  int      type;
+  double   time;         /* position in the recording, in seconds */
+  int64_t  block;        /* number of the block, from 0 */
+  int64_t  bytes;        /* bytes in the block */
+  int64_t  failed;       /* stretches that could not be read, so far */
+  double   latency;      /* seconds since the signal came in, for streams */
+} DECODER_EVENT;
+
+typedef void (*DECODER_CALLBACK)(const DECODER_EVENT *event, void *context);
+
+/* open a .wav file, or a .wav file in memory that is used in place and */
+/* must stay there until the decoder is closed. Progress is shown on     */
+/* messages and problems on errors, returns NULL on failure              */
+DECODER *decoderOpen(const char *name, const DECODER_SETTINGS *settings,
+		     FILE *messages, FILE *errors);
+DECODER *decoderOpenMemory(const uint8_t *wav, int64_t length,
+			   const DECODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors);
+
+/* open a stream (like a pipe) that is read once, as the recording comes */
+/* in. Without a frequency it starts with a wav header, otherwise it is  */
+/* raw PCM of bits per sample and channels. The stream is left open. It  */
+/* can not be normalized, swept or decoded on threads                     */
+DECODER *decoderOpenStream(FILE *stream, int frequency, int bits, int channels,
+			   const DECODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors);
+
+/* decode the whole recording, returns 0 on success and -1 (with a message */
+/* on errors) if there was not enough memory                               */
+int decoderRun(DECODER *decoder);
+
+/* pull the decoded .cas data, returns the number of bytes (0 at the end), */
+/* or get all of it at once without copying                               */
+int64_t decoderRead(DECODER *decoder, uint8_t *buffer, int64_t size);
+const uint8_t *decoderData(DECODER *decoder, int64_t *size);
+
+/* counters and times so far, NULL if the settings did not ask for them */
+STATS *decoderStats(DECODER *decoder);
+
+/* report events while decoding without threads. The data of a block can */
+/* be pulled with decoderRead as soon as it is reported                   */
+void decoderEvents(DECODER *decoder, DECODER_CALLBACK callback, void *context);
+
+void decoderClose(DECODER *decoder);
+
+
+
+/**************************************************************************/
+/* encoder (cas2wav)                                                      */
+/**************************************************************************/
+
+typedef struct
+{
+  int  baudrate;         /* output baudrate */
+  int  stime;            /* gap time between blocks, -1 for the default */
+  int  longHeader;       /* header pulses before a file and before the */
+  int  shortHeader;      /* next blocks of it, 0 for the default        */
+  int  longSilence;      /* milliseconds of silence before a file and  */
+  int  shortSilence;     /* before the next blocks, -1 for the default  */
+  int  rate;             /* output sample rate */
+  int  bits;             /* bits per sample, 8 or 16 */
+  int  threads;          /* batch jobs converted at the same time */
+  bool stats;            /* keep counters and time the stages */
+} ENCODER_SETTINGS;
+
+/* default arguments */
+#define ENCODER_DEFAULTS  { 1200, -1, 0, 0, -1, -1, 43200, 8, 0, false }
+
+typedef struct ENCODER ENCODER;
+
+/* a block of .cas data: a header and the data up to the next header */
+typedef struct
+{
+  int64_t  offset;       /* of the header */
+  int64_t  end;          /* of the data */
+  int      type;         /* type of the file that starts here, CAS_CUSTOM */
+                         /* for data blocks and unknown files             */
+} CAS_BLOCK;
+
+/* set the baudrate, header pulses and silences of a named tape profile, */
+/* or of a custom one given as baudrate:long:short:longgap:shortgap with */
+/* the header pulses and the silences in milliseconds. Returns 0 on      */
+/* success                                                               */
+int encoderProfile(const char *name, ENCODER_SETTINGS *settings);
+
+/* the name of a tape profile, NULL past the last one */
+const char *encoderProfileName(int index);
+
+/* fill in the header pulses and silences that are left to the default */
+void encoderFillDefaults(ENCODER_SETTINGS *settings);
+
+/* check if a tape made with these settings can be read, the problems */
+/* are shown on errors                                                 */
+bool encoderCheck(const ENCODER_SETTINGS *settings, FILE *errors);
+
+/* start an encoder, or one on .cas data in memory that is used in place */
+/* and must stay there until the encoder is closed                       */
+ENCODER *encoderOpen(const ENCODER_SETTINGS *settings,
+		     FILE *messages, FILE *errors);
+ENCODER *encoderOpenMemory(const uint8_t *cas, int64_t size,
+			   const ENCODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors);
+
+/* push .cas data, and tell when there is no more. Returns 0 on success */
+int  encoderWrite(ENCODER *encoder, const uint8_t *data, int64_t size);
+void encoderFinish(ENCODER *encoder);
+
+/* pull .wav samples, returns the number of bytes. 0 means more .cas data */
+/* is needed, or all samples are read once the encoder is finished        */
+int64_t encoderRead(ENCODER *encoder, uint8_t *buffer, int64_t size);
+
+/* the .wav header for the samples read so far */
+void encoderHeader(ENCODER *encoder, WAVE_HEADER *header);
+
+/* the number of bytes of all samples of .cas data in memory, and the .wav */
+/* header for them if header is not NULL, before any is read. Returns -1   */
+/* for pushed data                                                         */
+int64_t encoderSize(ENCODER *encoder, WAVE_HEADER *header);
+
+/* counters and times so far, NULL if the settings did not ask for them */
+STATS *encoderStats(ENCODER *encoder);
+
+/* use the blocks of the .cas data in memory from an index (see indexFile) */
+/* instead of finding them again. The index is used in place               */
+void encoderBlocks(ENCODER *encoder, const CAS_BLOCK *blocks, int64_t count);
+
+void encoderClose(ENCODER *encoder);
+
+
+
+/**************************************************************************/
+/* catalog (casdir)                                                       */
+/**************************************************************************/
+
+enum {
+  CAS_ASCII,
+  CAS_BINARY,
+  CAS_BASIC,
+  CAS_CUSTOM
+};
+
+/* a file on the tape */
+typedef struct
+{
+  int      type;
+  char     name[7];      /* not for custom blocks */
+  uint16_t start;        /* binary files only */
+  uint16_t stop;
+  uint16_t exec;
+  int64_t  offset;       /* custom blocks only, the data after the header */
+  int64_t  header;       /* file offset of the first header of the file */
+} CAS_ENTRY;
+
+typedef struct CATALOG CATALOG;
+
+/* start a catalog, or one on .cas data in memory that is used in place */
+/* and must stay there until the catalog is closed                      */
+CATALOG *catalogOpen(void);
+CATALOG *catalogOpenMemory(const uint8_t *cas, int64_t size);
+
+/* push .cas data, and tell when there is no more. Returns 0 on success */
+int  catalogWrite(CATALOG *catalog, const uint8_t *data, int64_t size);
+void catalogFinish(CATALOG *catalog);
+
+/* pull the next file, returns false if more .cas data is needed, or if */
+/* all files are listed once the catalog is finished                     */
+bool catalogNext(CATALOG *catalog, CAS_ENTRY *entry);
+
+/* use the blocks of the .cas data in memory from an index (see indexFile) */
+/* instead of finding them again. The index is used in place               */
+void catalogBlocks(CATALOG *catalog, const CAS_BLOCK *blocks, int64_t count);
+
+void catalogClose(CATALOG *catalog);
+
+
+
+/**************************************************************************/
+/* shared by the library                                                  */
+/**************************************************************************/
+
+/* .cas data pushed by the caller, or the caller's own buffer */
+typedef struct
+{
+  uint8_t *data;
+  int64_t  size;
+  int64_t  allocated;    /* 0 if the data belongs to the caller */
+  int64_t  position;     /* next byte to look at */
+  int64_t  base;         /* file offset of data[0] */
+  bool     finished;     /* no more data will be pushed */
+} CASDATA;
+
+/* add data, dropping what is looked at already. Returns 0 on success */
+int pushData(CASDATA *cas, const uint8_t *data, int64_t size);
+
+/* check if there are count bytes to look at, or there never will be */
+bool haveData(CASDATA *cas, int64_t count);
+
+/* the type of the file that follows a header */
+int casType(const uint8_t *data, int64_t available);
+
+/* find the blocks of .cas data in one scan, returns NULL if out of memory */
+CAS_BLOCK *indexBlocks(const uint8_t *data, int64_t size, int64_t *count);
+
+/* the blocks of a .cas file in memory, kept in an index file next to it  */
+/* (name.idx) and only found again when the .cas file changes. Returns    */
+/* NULL if out of memory, the caller frees the index                      */
+CAS_BLOCK *indexFile(const char *name, const uint8_t *data, int64_t size,
+		     int64_t *count);
+
+
+#endif
@@ -0,0 +1,282 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         catalog.c                                                */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Catalog of the castools library, lists the files in the */
+/*               contents of a .cas file.                                 */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+
+#include "castools.h"
+
+/* .cas data is looked at 8 bytes at a time */
+#define CHUNK             8
+
+/* .cas data is little endian, read it byte by byte */
+#define GETSHORT(p) ( (uint16_t)((p)[0] | ((p)[1]<<8)) )
+
+enum next {
+  NEXT_NONE,
+  NEXT_ASCII,
+  NEXT_BINARY,
+  NEXT_DATA,
+  NEXT_TEXT              /* in the blocks of an ascii file */
+};
+
+struct CATALOG
+{
+  CASDATA  cas;
+  CAS_BLOCK *blocks;     /* headers in the .cas data, if it is all there */
+  int64_t  count;
+  int64_t  block;        /* first block not before the position */
+  bool     owned;        /* the table is freed with the catalog */
+  bool     unindexed;    /* the table is still to be made */
+  int      next;
+  int64_t  first;        /* file offset of the first header of the file */
+  char     name[6];      /* name of the last file found */
+};
+
+
+
+/* start a catalog */
+CATALOG *catalogOpen(void)
+{
+  CATALOG *catalog;
+
+  if ((catalog=(CATALOG*)calloc(1,sizeof(CATALOG)))==NULL) return NULL;
+  catalog->next=NEXT_NONE;
+
+  return catalog;
+}
+
+
+
+/* start a catalog on .cas data in memory, used in place */
+CATALOG *catalogOpenMemory(const uint8_t *cas, int64_t size)
+{
+  CATALOG *catalog = catalogOpen();
+
+  if (catalog) {
+    catalog->cas.data=(uint8_t*)cas;
+    catalog->cas.size=size;
+    catalog->cas.finished=true;
+    catalog->unindexed=true;
+  }
+
+  return catalog;
+}
+
+
+
+/* push .cas data */
+int catalogWrite(CATALOG *catalog, const uint8_t *data, int64_t size)
+{
+  return pushData(&catalog->cas,data,size);
+}
+
+
+
+/* there is no more .cas data */
+void catalogFinish(CATALOG *catalog)
+{
+  catalog->cas.finished=true;
+}
+
+
+
+/* copy the name that follows the file type after a header */
+void copyName(CATALOG *catalog, const uint8_t *data, int64_t available)
+{
+  if (available>6) available=6;
+  if (available>0) memcpy(catalog->name,data,available);
+}
+
+
+
+/* go to the next header that starts a chunk, returns false if there is */
+/* none                                                                  */
+bool nextBlock(CATALOG *catalog)
+{
+  CASDATA *cas = &catalog->cas;
+
+  while (catalog->block<catalog->count &&
+	 (catalog->blocks[catalog->block].offset<cas->position ||
+	  catalog->blocks[catalog->block].offset%CHUNK))
+    catalog->block++;
+
+  if (catalog->block==catalog->count) {
+    cas->position=cas->size;
+    return false;
+  }
+
+  cas->position=catalog->blocks[catalog->block].offset;
+  return true;
+}
+
+
+
+/* pull the next file */
+bool catalogNext(CATALOG *catalog, CAS_ENTRY *entry)
+{
+  CASDATA *cas = &catalog->cas;
+  const uint8_t *data;
+  int64_t  available;
+
+  memset(entry,0,sizeof(CAS_ENTRY));
+
+  /* all data is there, find the blocks once and jump from header to */
+  /* header. Without a table every chunk is looked at                */
+  if (catalog->unindexed) {
+    catalog->blocks=indexBlocks(cas->data,cas->size,&catalog->count);
+    catalog->owned=true;
+    catalog->unindexed=false;
+  }
+
+  for (;;) {
+
+    /* the blocks of an ascii file end with an end of file mark */
+    if (catalog->next==NEXT_TEXT && catalog->blocks) {
+
+      data=(const uint8_t*)memchr(cas->data+cas->position,0x1a,
+				  cas->size-cas->position);
+      if (data==NULL) { cas->position=cas->size; return false; }
+
+      cas->position+=((data-cas->data-cas->position)/CHUNK+1)*CHUNK;
+      catalog->next=NEXT_NONE;
+      continue;
+    }
+
+    if (catalog->next==NEXT_TEXT) {
+
+      if (!haveData(cas,CHUNK)) return false;
+      if (cas->size-cas->position<CHUNK ||
+	  memchr(cas->data+cas->position,0x1a,CHUNK)!=NULL)
+	catalog->next=NEXT_NONE;
+      cas->position+=CHUNK;
+      continue;
+    }
+
+    if (catalog->blocks && !nextBlock(catalog)) return false;
+
+    if (!haveData(cas,CHUNK)) return false;
+    if (cas->size-cas->position<CHUNK) return false;
+
+    data=cas->data+cas->position;
+    available=cas->size-cas->position-CHUNK;
+
+    if (memcmp(data,HEADER,CHUNK)) {
+      cas->position+=CHUNK;
+      continue;
+    }
+
+    /* wait for the data that follows the header */
+    if (catalog->next==NEXT_NONE && !haveData(cas,CHUNK+16)) return false;
+    if (catalog->next==NEXT_BINARY && !haveData(cas,CHUNK+8)) return false;
+
+    if (catalog->next==NEXT_NONE) catalog->first=cas->base+cas->position;
+    entry->header=catalog->first;
+
+    cas->position+=CHUNK;
+    data+=CHUNK;
+
+    switch (catalog->next) {
+
+    case NEXT_NONE:
+    default:
+      if (available<10) { cas->position=cas->size; return false; }
+
+      if (!memcmp(data,ASCII,10) || !memcmp(data,BIN,10) ||
+	  !memcmp(data,BASIC,10)) {
+
+	copyName(catalog,data+10,available-10);
+	memcpy(entry->name,catalog->name,6);
+	cas->position+=16;
+
+	if (!memcmp(data,ASCII,10)) {
+	  catalog->next=NEXT_ASCII;
+	  entry->type=CAS_ASCII;
+	  return true;
+	}
+
+	if (!memcmp(data,BASIC,10)) {
+	  catalog->next=NEXT_DATA;
+	  entry->type=CAS_BASIC;
+	  return true;
+	}
+
+	/* binary files are listed with the addresses in the next block */
+	catalog->next=NEXT_BINARY;
+	break;
+      }
+
+      entry->type=CAS_CUSTOM;
+      entry->offset=cas->base+cas->position;
+      cas->position+=8;
+      return true;
+
+    case NEXT_ASCII:
+      catalog->next=NEXT_TEXT;
+      break;
+
+    case NEXT_BINARY:
+      if (available<8) { cas->position=cas->size; return false; }
+
+      entry->type=CAS_BINARY;
+      memcpy(entry->name,catalog->name,6);
+      entry->start=GETSHORT(data);
+      entry->stop=GETSHORT(data+2);
+      entry->exec=GETSHORT(data+4);
+      if (!entry->exec) entry->exec=entry->start;
+
+      cas->position+=8;
+      catalog->next=NEXT_NONE;
+      return true;
+
+    case NEXT_DATA:
+      catalog->next=NEXT_NONE;
+      break;
+    }
+  }
+}
+
+
+
+/* use the blocks from an index, before the catalog is read */
+void catalogBlocks(CATALOG *catalog, const CAS_BLOCK *blocks, int64_t count)
+{
+  if (catalog->owned) free(catalog->blocks);
+
+  catalog->blocks=(CAS_BLOCK*)blocks;
+  catalog->count=count;
+  catalog->block=0;
+  catalog->owned=false;
+  catalog->unindexed=false;
+}
+
+
+
+/* release the catalog */
+void catalogClose(CATALOG *catalog)
+{
+  if (catalog==NULL) return;
+
+  if (catalog->cas.allocated) free(catalog->cas.data);
+  if (catalog->owned) free(catalog->blocks);
+  free(catalog);
+}
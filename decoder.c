@@ -0,0 +1,3649 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         decoder.c                                                */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Decoder of the castools library, reads the signal of a   */
+/*               sampled MSX tape in a .wav file and extracts the .cas    */
+/*               data from it.                                            */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/* MultiCPU Copyright 2007 Ramones     (ramones@kurarizeku.net)           */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+#include <stdarg.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "castools.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#define MMAP
+#endif
+
+/* vectorized kernels, build with -DNOSIMD for the plain C versions only */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(NOSIMD)
+#include <immintrin.h>
+#define SIMD
+#endif
+
+#define THRESHOLD_SILENCE   2315  /* microseconds, 100 samples at 43200 Hz */
+#define THRESHOLD_HEADER    25    /* pulses */
+
+/* streaming window sizes (in samples) */
+#define WINDOW_SIZE         (1<<20)
+#define READ_SIZE           (1<<16)
+
+/* samples run through all preprocessing at once, while they are in cache */
+#define TILE_SIZE           (1<<14)
+
+/* a stream is read in tiles of a fraction of a second, so a live decoder */
+/* never waits for more of the signal than that                           */
+#define LIVE_TILES          50
+
+/* samples in a stream of unknown length, its end is found by reading it */
+#define STREAM_SIZE         ((int64_t)1<<60)
+
+/* reads of a stream remembered, to tell how long a sample has been there */
+#define ARRIVALS            256
+
+/* number of pulses kept in memory */
+#define PULSE_WINDOW        (1<<16)
+
+/* granularity for releasing mapped file data (a multiple of the page size) */
+#define MAP_PAGES           (1<<16)
+
+/* samples per lane in the vectorized envelope correction */
+#define ENVELOPE_BLOCK      64
+
+/* longest bit the tone demodulator handles, in samples, and the scale */
+/* of its tables                                                       */
+#define TONE_SIZE           1024
+#define TONE_SCALE          4096
+
+/* samples read before a span that is read again, for the filters */
+#define RECOVER_LEAD        256
+
+/* bytes looked past a byte that can not be read, to see how much is */
+/* lost, and the bytes that have to be read before they are kept     */
+#define RECOVER_SKIPS       32
+#define RECOVER_RUN         8
+
+/* quiet samples needed to cut the tape in parts that are decoded apart */
+#define SEGMENT_GAP         4096
+
+/* wav definitions */
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+/* wav files are little endian, read them byte by byte */
+#define GETSHORT(p) ( (uint16_t)((p)[0] | ((p)[1]<<8)) )
+#define GETLONG(p)  ( (uint32_t)((p)[0] | ((p)[1]<<8) | ((p)[2]<<16) | \
+                                 ((uint32_t)(p)[3]<<24)) )
+
+/* settings tried by a sweep */
+#define ITEMS(a) ((int)(sizeof(a)/sizeof((a)[0])))
+int   sweepThresholds[] = { 3, 5, 8 };
+int   sweepEnvelopes[]  = { 0, 1, 2, 4 };
+float sweepWindows[]    = { 1.3, 1.5, 1.7 };
+
+/* settings tried on a span that could not be read, in this order */
+typedef struct
+{
+  int      threshold;
+  int      envelope;
+  float    window;
+  int      engine;
+} RUNG;
+
+RUNG ladder[] = {
+  { 3, 2, 1.5, DECODER_PULSES },
+  { 8, 2, 1.5, DECODER_PULSES },
+  { 5, 2, 1.3, DECODER_PULSES },
+  { 5, 2, 1.7, DECODER_PULSES },
+  { 5, 0, 1.5, DECODER_PULSES },
+  { 5, 4, 1.5, DECODER_PULSES },
+  { 5, 8, 1.5, DECODER_PULSES },
+  { 5, 2, 1.5, DECODER_TONES },
+  { 5, 4, 1.5, DECODER_TONES },
+  { 8, 8, 1.7, DECODER_TONES }
+};
+
+/* a pulse (half a wave) in the signal */
+typedef struct
+{
+  int64_t  offset;       /* first sample of the pulse */
+  int32_t  width;        /* number of samples */
+  int32_t  amplitude;    /* peak to trough level */
+} PULSE;
+
+/* streaming window on the (processed) sample data and its pulses */
+typedef struct
+{
+  FILE    *file;
+  uint8_t *map;          /* mapped wav file, NULL if not mapped */
+  int64_t  mapped;       /* mapped bytes still in memory start here */
+  int64_t  length;       /* length of the wav file */
+  int64_t  offset;       /* file offset of the sample data */
+  int      frequency;    /* sample rate the signal is decoded at */
+  int      factor;       /* sample frames per decoded sample */
+  int32_t  silence;      /* quiet samples that make a silence */
+  int      channels;     /* number of channels */
+  bool     guessed;      /* no fmt chunk, format is assumed */
+  char    *name;         /* wav file name */
+  bool     shared;       /* map belongs to another tape */
+  bool     memory;       /* map is memory of the caller, leave it alone */
+  bool     stream;       /* file of the caller, read once and left open */
+  int      format;       /* wave format tag */
+  int      align;        /* bytes per sample frame */
+  int      bits;         /* bits per sample */
+  int      channel;      /* offset of the used sample within a frame */
+  int      first;        /* and of the same byte of the first channel */
+  int      source;       /* channel or mix used, DECODER_RIGHT and on */
+  int64_t  size;         /* total number of samples */
+  int64_t  read;         /* samples read from file */
+  int64_t  ready;        /* samples with all processing applied */
+  int64_t  base;         /* sample number of buffer[0] */
+  int64_t *pass;         /* progress of each envelope pass */
+  int64_t  indexed;      /* samples in the silence index */
+  uint64_t *loud;        /* bit set for each loud sample */
+  int      threshold;    /* decoder settings */
+  int      envelope;
+  bool     phase;
+  float    window;
+  int      engine;
+  bool     recover;
+  int16_t *tones;        /* both tones over a bit, for DECODER_TONES */
+  float    cell;         /* samples per bit the tables are made for */
+  int32_t  cells;        /* samples correlated per bit */
+  float    scale;        /* normalize factor, 0 to leave the level alone */
+  int32_t  tile;         /* samples processed at once */
+  int64_t  arrived[ARRIVALS]; /* samples read from a stream after a read */
+  double   arrival[ARRIVALS]; /* and the time of the read */
+  int64_t  arrivals;     /* reads of the stream */
+  int8_t  *buffer;       /* WINDOW_SIZE samples */
+  uint8_t *frames;       /* READ_SIZE raw frames, if not mapped */
+  int8_t  *input;        /* READ_SIZE samples waiting for decimation */
+  int64_t  cursor;       /* sample where the next pulse starts */
+  int64_t  pulsecount;   /* pulses measured */
+  int64_t  pulsebase;    /* pulse number of pulses[0] */
+  PULSE   *pulses;       /* PULSE_WINDOW pulses */
+  PULSE    end;          /* returned for pulses past the end */
+  STATS   *stats;        /* counters and times, NULL to keep none */
+} TAPE;
+
+/* bytes read from a span, by the rung being tried and the best so far, */
+/* and a tape for each rung, opened once for all spans of a segment    */
+typedef struct
+{
+  uint8_t *bytes;
+  uint8_t *best;
+  int64_t  size;
+  int64_t  bestsize;
+  TAPE     tapes[ITEMS(ladder)];
+  int      opened;
+} RECOVERY;
+
+/* data that could not be read, up to the next header or silence */
+typedef struct
+{
+  int64_t  start;        /* first sample of the byte that failed */
+  int64_t  end;          /* sample where the next header or silence starts */
+  int64_t  block;        /* block the data belongs to */
+  int64_t  offset;       /* in the decoded data, where the bytes go */
+  float    average;      /* width of a short pulse in the block */
+} SPAN;
+
+/* where a block is on the tape */
+typedef struct
+{
+  int64_t  start;        /* sample where the header starts */
+  int64_t  end;          /* sample where reading the data stopped */
+  bool     complete;     /* read up to a silence or the next header */
+  bool     recovered;    /* has bytes that were read again */
+} PLACE;
+
+/* a part of the tape and what is decoded from it */
+typedef struct
+{
+  int64_t  start;        /* first sample */
+  int64_t  end;          /* sample after the last one */
+  uint8_t *data;         /* decoded bytes */
+  int64_t  length;
+  int64_t  size;
+  int64_t *blocks;       /* length of the data at each header */
+  int64_t  count;
+  int64_t  allocated;
+  PLACE   *places;       /* and where each block is */
+  int64_t  placesize;
+  char    *log;          /* messages kept until the segment is written */
+  int64_t  logged;
+  int64_t  logsize;
+  FILE    *messages;     /* where messages are shown */
+  bool     buffered;     /* keep messages instead of showing them */
+  bool     done;
+  int64_t  valid;        /* blocks read up to a silence or the next header */
+  int64_t  complete;     /* bytes in those blocks */
+  int64_t  failed;       /* stretches of data that could not be read */
+  SPAN    *spans;        /* and where they are, to read them again */
+  int64_t  spancount;
+  int64_t  spansize;
+  DECODER *decoder;      /* data is added to it as soon as a block is read */
+  int64_t  flushed;      /* headers added to the decoder */
+  int64_t  written;      /* bytes added to the decoder */
+} SEGMENT;
+
+/* a combination of settings tried by a sweep, and what it decoded */
+typedef struct
+{
+  int      threshold;
+  int      envelope;
+  float    window;
+  bool     phase;
+  bool     normalize;
+  int      source;
+  bool     recover;
+  SEGMENT  segment;
+} RUN;
+
+/* names of the sources of a stereo recording */
+const char *sourceNames[DECODER_SOURCES] = {
+  "right channel", "left channel", "sum", "difference"
+};
+
+/* a block of one of the runs, to merge them */
+typedef struct
+{
+  SEGMENT *segment;
+  int64_t  block;
+} PICK;
+
+/* segments or runs shared by the decoding threads */
+typedef struct
+{
+  TAPE    *tape;         /* the threads open their own window on this tape */
+  float    scale;        /* normalize factor for the runs, 0 for each its own */
+  SEGMENT *segments;
+  RUN     *runs;
+  int32_t  count;
+  int32_t  next;         /* first segment not taken by a thread */
+  pthread_mutex_t lock;
+} WORK;
+
+/* a decoder, the recording and the .cas data decoded from it */
+struct DECODER
+{
+  DECODER_SETTINGS settings;
+  TAPE     tape;
+  char    *name;         /* wav file name, NULL for memory */
+  int      frequency;    /* sample rate of the wav file */
+  FILE    *messages;
+  FILE    *errors;
+  uint8_t *output;       /* .cas data */
+  int64_t  length;
+  int64_t  size;
+  int64_t  position;     /* bytes pulled by decoderRead */
+  bool     header;       /* output ends with a .cas header */
+  DECODER_CALLBACK callback; /* reports events while decoding, or NULL */
+  void    *context;
+  STATS    stats;
+};
+
+/* the kernels are picked once for all decoders */
+pthread_once_t kernelsPicked = PTHREAD_ONCE_INIT;
+
+
+
+/* a sample of a channel in a frame, as a signed 8-bit value */
+static inline int channelSample(TAPE *tape, const uint8_t *src)
+{
+  uint32_t value;
+  float  sample;
+
+  if (tape->format!=WAVE_FORMAT_IEEE_FLOAT)
+    return (int8_t)(tape->bits==8 ? src[0]^128 : src[0]);
+
+  value=GETLONG(src); memcpy(&sample,&value,sizeof(sample));
+  sample*=128;
+  return sample>=127 ? 127 : sample<=-128 ? -128 : (int)sample;
+}
+
+
+
+/* convert raw sample frames to the first channel, or the sum or the */
+/* difference of both channels, halved so a signal on both channels  */
+/* keeps its level                                                    */
+void mixSamples(TAPE *tape, const uint8_t *frames, int8_t *buffer, int32_t count)
+{
+  int32_t i;
+  int left,right,data;
+
+  for (i=0;i<count;i++,frames+=tape->align) {
+
+    left=channelSample(tape,frames+tape->first);
+    right=channelSample(tape,frames+tape->channel);
+
+    if (tape->source==DECODER_LEFT) data=left;
+    else if (tape->source==DECODER_SUM) data=(left+right)/2;
+    else data=(left-right)/2;
+
+    buffer[i] = tape->phase ? -data : data;
+  }
+}
+
+
+
+/* convert raw sample frames to signed 8-bit samples */
+void convertSamples(TAPE *tape, const uint8_t *frames, int8_t *buffer, int32_t count)
+{
+  const uint8_t *src = frames+tape->channel;
+  int32_t i;
+  uint32_t value;
+  float  sample;
+  int8_t data;
+
+  if (tape->source!=DECODER_RIGHT) {
+    mixSamples(tape,frames,buffer,count);
+    return;
+  }
+
+  /* only the (most significant byte of the) last channel is used */
+  if (tape->format==WAVE_FORMAT_IEEE_FLOAT)
+
+    for (i=0;i<count;i++,src+=tape->align) {
+
+      value=GETLONG(src); memcpy(&sample,&value,sizeof(sample));
+      sample*=128;
+      data = sample>=127 ? 127 : sample<=-128 ? -128 : (int8_t)sample;
+      buffer[i] = tape->phase ? -data : data;
+    }
+
+  else if (tape->bits==8)
+
+    for (i=0;i<count;i++,src+=tape->align) {
+
+      data=src[0]^128;
+      buffer[i] = tape->phase ? -data : data;
+    }
+
+  else
+
+    for (i=0;i<count;i++,src+=tape->align) {
+
+      data=src[0];
+      buffer[i] = tape->phase ? -data : data;
+    }
+}
+
+
+
+/* make signal as loud as possible */
+void normalizeAmplitude(int8_t *buffer,int32_t size,float scale)
+{
+  int32_t i;
+  for (i=0;i<size;i++) buffer[i]*=scale;
+}
+
+
+
+/* convert raw sample frames, phase shift and normalize them */
+/* in one go, a scale of 0 leaves the level alone             */
+void prepareSamples(TAPE *tape, const uint8_t *frames, int8_t *buffer,
+		    int32_t count, float scale)
+{
+  convertSamples(tape,frames,buffer,count);
+  if (scale>0) normalizeAmplitude(buffer,count,scale);
+}
+
+
+
+/* low pass filter and keep one out of every factor samples, the filter */
+/* is a triangle over two groups (a box filter applied twice), input    */
+/* holds the last factor-1 samples of the previous group up front       */
+void decimateSamples(const int8_t *input, int8_t *buffer, int32_t count,
+		     int factor)
+{
+  int32_t i,sum;
+  int32_t half = factor*factor/2;
+  int j;
+
+  for (i=0;i<count;i++,input+=factor) {
+
+    sum=factor*input[factor-1];
+    for (j=1;j<factor;j++)
+      sum+=(factor-j)*(input[factor-1-j]+input[factor-1+j]);
+
+    buffer[i] = (sum>=0 ? sum+half : sum-half)/(factor*factor);
+  }
+}
+
+
+
+/* correct envelope and denoise signal, this is the same as    */
+/* (0.5*a+1.0*b+2.0*c)/3.5 but without the floating point math */
+void correctEnvelope(int8_t *buffer,int32_t from,int32_t to)
+{
+  int32_t i;
+  for (i=from;i<to;i++)
+
+    buffer[i] = ( 1*buffer[i-1] +
+		  2*buffer[i]   +
+		  4*buffer[i+1]   ) / 7;
+}
+
+
+
+/* get the peak level of the signal */
+int peakLevel(const int8_t *buffer,int32_t size)
+{
+  int32_t i;
+  int maximum = 0;
+
+  for (i=0;i<size;i++)
+    if (abs(buffer[i])>maximum) maximum=abs(buffer[i]);
+
+  return maximum;
+}
+
+
+
+/* flag which of count (up to 64) samples are loud, one bit per sample */
+uint64_t loudSamples(const int8_t *buffer, int count, int threshold)
+{
+  uint64_t word,packed;
+  uint8_t  flags[64];
+  int8_t   block[64];
+  int j;
+
+  if (count<64) {
+    memset(block,0,sizeof(block));
+    memcpy(block,buffer,count);
+    buffer=block;
+  }
+
+  /* flag the loud samples, then pack eight flags at a time */
+  for (j=0;j<64;j++)
+    flags[j]=(buffer[j]>=threshold) | (buffer[j]<=-threshold);
+
+  word=0;
+  for (j=0;j<8;j++) {
+    memcpy(&packed,flags+8*j,8);
+    word|=((packed*0x0102040810204080ULL)>>56)<<(8*j);
+  }
+
+  if (count<64) word&=((uint64_t)1<<count)-1;
+  return word;
+}
+
+
+
+/* flag the loud samples of a number of whole words */
+void flagLoud(const int8_t *buffer,uint64_t *loud,int32_t words,int threshold)
+{
+  int32_t i;
+  for (i=0;i<words;i++) loud[i]=loudSamples(buffer+64*i,64,threshold);
+}
+
+
+
+/* correlate samples with the four rows of the tone tables (cosine and */
+/* sine of the low and the high tone)                                  */
+void correlateTones(const int8_t *samples,const int16_t *tones,int32_t count,
+		    int32_t *sums)
+{
+  int32_t i;
+  int     k;
+
+  for (k=0;k<4;k++) {
+    sums[k]=0;
+    for (i=0;i<count;i++) sums[k]+=samples[i]*tones[k*TONE_SIZE+i];
+  }
+}
+
+
+
+/* signal processing kernels, replaced by vectorized versions at startup */
+/* when the cpu supports them, these have to give the very same results  */
+void (*prepareKernel)(TAPE*,const uint8_t*,int8_t*,int32_t,float) = prepareSamples;
+void (*envelopeKernel)(int8_t*,int32_t,int32_t)                   = correctEnvelope;
+int  (*peakKernel)(const int8_t*,int32_t)                         = peakLevel;
+void (*loudKernel)(const int8_t*,uint64_t*,int32_t,int)           = flagLoud;
+void (*toneKernel)(const int8_t*,const int16_t*,int32_t,int32_t*)  = correlateTones;
+
+
+
+#ifdef SIMD
+
+/* The envelope correction depends on its own previous output, so it is */
+/* vectorized over blocks of samples instead of over samples. All lanes  */
+/* start their block from silence, afterwards each block is corrected    */
+/* from the real level before it until it meets the guess again. As each */
+/* step divides the previous level by 7 that takes just a few samples.   */
+void fixEnvelope(int8_t *buffer,const int8_t *input,int32_t blocks)
+{
+  int32_t i,j;
+  int8_t  level;
+
+  for (j=0;j<blocks;j++)
+    for (i=j*ENVELOPE_BLOCK;i<(j+1)*ENVELOPE_BLOCK;i++) {
+
+      level=(buffer[i-1]+2*input[i]+4*input[i+1])/7;
+      if (level==buffer[i]) break;
+      buffer[i]=level;
+    }
+}
+
+
+
+/* SSE2: 8 blocks of 16 bit levels per vector */
+__attribute__((target("sse2")))
+static inline void transposeSSE2(__m128i *v)
+{
+  __m128i a[8],b[8];
+  int m;
+
+  for (m=0;m<4;m++) {
+    a[2*m]  =_mm_unpacklo_epi16(v[2*m],v[2*m+1]);
+    a[2*m+1]=_mm_unpackhi_epi16(v[2*m],v[2*m+1]);
+  }
+  for (m=0;m<2;m++) {
+    b[4*m]  =_mm_unpacklo_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+1]=_mm_unpackhi_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+2]=_mm_unpacklo_epi32(a[4*m+1],a[4*m+3]);
+    b[4*m+3]=_mm_unpackhi_epi32(a[4*m+1],a[4*m+3]);
+  }
+  for (m=0;m<4;m++) {
+    v[2*m]  =_mm_unpacklo_epi64(b[m],b[m+4]);
+    v[2*m+1]=_mm_unpackhi_epi64(b[m],b[m+4]);
+  }
+}
+
+
+
+__attribute__((target("sse2")))
+static inline __m128i widenSSE2(const int8_t *input)
+{
+  __m128i x=_mm_loadl_epi64((const __m128i*)input);
+  return _mm_srai_epi16(_mm_unpacklo_epi8(x,x),8);
+}
+
+
+
+__attribute__((target("sse2")))
+void correctEnvelopeSSE2(int8_t *buffer,int32_t from,int32_t to)
+{
+  int8_t  input[8*ENVELOPE_BLOCK+1];
+  __m128i v[8],level,sum;
+  __m128i seventh = _mm_set1_epi16(9363);   /* 65536/7 */
+  int32_t i,k;
+  int     m;
+
+  for (i=from;i+8*ENVELOPE_BLOCK<=to;i+=8*ENVELOPE_BLOCK) {
+
+    memcpy(input,buffer+i,sizeof(input));
+    level=_mm_setzero_si128();
+
+    for (k=0;k<ENVELOPE_BLOCK;k+=8) {
+
+      /* 2*b+4*c of 8 samples per block, turned into 8 samples of all blocks */
+      for (m=0;m<8;m++)
+	v[m]=_mm_add_epi16(_mm_slli_epi16(widenSSE2(input+m*ENVELOPE_BLOCK+k),1),
+			   _mm_slli_epi16(widenSSE2(input+m*ENVELOPE_BLOCK+k+1),2));
+      transposeSSE2(v);
+
+      /* a+2*b+4*c divided by 7, rounding towards zero like the reference */
+      for (m=0;m<8;m++) {
+	sum=_mm_add_epi16(level,v[m]);
+	level=_mm_add_epi16(_mm_mulhi_epi16(sum,seventh),_mm_srli_epi16(sum,15));
+	v[m]=level;
+      }
+
+      transposeSSE2(v);
+      for (m=0;m<8;m++)
+	_mm_storel_epi64((__m128i*)(buffer+i+m*ENVELOPE_BLOCK+k),
+			 _mm_packs_epi16(v[m],v[m]));
+    }
+
+    fixEnvelope(buffer+i,input,8);
+  }
+
+  correctEnvelope(buffer,i,to);
+}
+
+
+
+__attribute__((target("sse2")))
+static inline __m128i scaleSSE2(__m128i x,__m128 factor)
+{
+  __m128i w[2],d[4];
+  int m;
+
+  w[0]=_mm_srai_epi16(_mm_unpacklo_epi8(x,x),8);
+  w[1]=_mm_srai_epi16(_mm_unpackhi_epi8(x,x),8);
+
+  for (m=0;m<4;m++) {
+    d[m]= m&1 ? _mm_unpackhi_epi16(w[m/2],w[m/2]) :
+                _mm_unpacklo_epi16(w[m/2],w[m/2]);
+    d[m]=_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(d[m],16)),
+				     factor));
+  }
+
+  return _mm_packs_epi16(_mm_packs_epi32(d[0],d[1]),_mm_packs_epi32(d[2],d[3]));
+}
+
+
+
+__attribute__((target("sse2")))
+void prepareSamplesSSE2(TAPE *tape, const uint8_t *frames, int8_t *buffer,
+			int32_t count, float scale)
+{
+  const __m128i *src;
+  __m128i x,flip,bias;
+  __m128  factor = _mm_set1_ps(scale);
+  int32_t i;
+
+  /* only the last byte of 1, 2 or 4 byte frames is picked this way */
+  if (tape->format!=WAVE_FORMAT_PCM || tape->source!=DECODER_RIGHT ||
+      (tape->align!=1 && tape->align!=2 && tape->align!=4)) {
+    prepareSamples(tape,frames,buffer,count,scale);
+    return;
+  }
+
+  flip=_mm_set1_epi8(tape->phase ? -1 : 0);
+  bias=_mm_set1_epi8(tape->bits==8 ? -128 : 0);
+
+  for (i=0;i+16<=count;i+=16) {
+
+    src=(const __m128i*)(frames+i*tape->align);
+
+    if (tape->align==1) x=_mm_loadu_si128(src);
+    else if (tape->align==2)
+      x=_mm_packus_epi16(_mm_srli_epi16(_mm_loadu_si128(src),8),
+			 _mm_srli_epi16(_mm_loadu_si128(src+1),8));
+    else
+      x=_mm_packus_epi16(_mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(src),24),
+					 _mm_srli_epi32(_mm_loadu_si128(src+1),24)),
+			 _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(src+2),24),
+					 _mm_srli_epi32(_mm_loadu_si128(src+3),24)));
+
+    /* 8 bit samples are unsigned, negate by flipping and adding one */
+    x=_mm_xor_si128(x,bias);
+    x=_mm_sub_epi8(_mm_xor_si128(x,flip),flip);
+    if (scale>0) x=scaleSSE2(x,factor);
+
+    _mm_storeu_si128((__m128i*)(buffer+i),x);
+  }
+
+  prepareSamples(tape,frames+i*tape->align,buffer+i,count-i,scale);
+}
+
+
+
+__attribute__((target("sse2")))
+int peakLevelSSE2(const int8_t *buffer,int32_t size)
+{
+  __m128i x,sign,peak = _mm_setzero_si128();
+  uint8_t levels[16];
+  int32_t i;
+  int     maximum;
+
+  /* absolute values as unsigned bytes, so -128 is 128 */
+  for (i=0;i+16<=size;i+=16) {
+    x=_mm_loadu_si128((const __m128i*)(buffer+i));
+    sign=_mm_cmpgt_epi8(_mm_setzero_si128(),x);
+    peak=_mm_max_epu8(peak,_mm_sub_epi8(_mm_xor_si128(x,sign),sign));
+  }
+
+  maximum=peakLevel(buffer+i,size-i);
+  _mm_storeu_si128((__m128i*)levels,peak);
+  for (i=0;i<16;i++) if (levels[i]>maximum) maximum=levels[i];
+
+  return maximum;
+}
+
+
+
+__attribute__((target("sse2")))
+void flagLoudSSE2(const int8_t *buffer,uint64_t *loud,int32_t words,
+		  int threshold)
+{
+  __m128i x,high,low;
+  uint64_t word;
+  int32_t i;
+  int     m;
+
+  /* thresholds beyond the sample range are left to the reference */
+  if (threshold<=0 || threshold>128) {
+    flagLoud(buffer,loud,words,threshold);
+    return;
+  }
+
+  high=_mm_set1_epi8(threshold-1);
+  low=_mm_set1_epi8(1-threshold);
+
+  for (i=0;i<words;i++) {
+
+    word=0;
+    for (m=0;m<4;m++) {
+      x=_mm_loadu_si128((const __m128i*)(buffer+64*i+16*m));
+      word|=(uint64_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi8(x,high),
+						       _mm_cmpgt_epi8(low,x)))<<(16*m);
+    }
+    loud[i]=word;
+  }
+}
+
+
+
+__attribute__((target("sse2")))
+void correlateTonesSSE2(const int8_t *samples,const int16_t *tones,
+			int32_t count,int32_t *sums)
+{
+  __m128i x,total[4];
+  int32_t i,rest[4];
+  int32_t lanes[4];
+  int     k,m;
+
+  for (k=0;k<4;k++) total[k]=_mm_setzero_si128();
+
+  /* 8 samples at a time, multiplied and added in pairs */
+  for (i=0;i+8<=count;i+=8) {
+    x=widenSSE2(samples+i);
+    for (k=0;k<4;k++)
+      total[k]=_mm_add_epi32(total[k],
+		 _mm_madd_epi16(x,_mm_loadu_si128((const __m128i*)
+						  (tones+k*TONE_SIZE+i))));
+  }
+
+  correlateTones(samples+i,tones+i,count-i,rest);
+
+  for (k=0;k<4;k++) {
+    _mm_storeu_si128((__m128i*)lanes,total[k]);
+    sums[k]=rest[k];
+    for (m=0;m<4;m++) sums[k]+=lanes[m];
+  }
+}
+
+
+
+/* AVX2: 16 blocks per vector, blocks m and m+8 share a row */
+__attribute__((target("avx2")))
+static inline void transposeAVX2(__m256i *v)
+{
+  __m256i a[8],b[8];
+  int m;
+
+  for (m=0;m<4;m++) {
+    a[2*m]  =_mm256_unpacklo_epi16(v[2*m],v[2*m+1]);
+    a[2*m+1]=_mm256_unpackhi_epi16(v[2*m],v[2*m+1]);
+  }
+  for (m=0;m<2;m++) {
+    b[4*m]  =_mm256_unpacklo_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+1]=_mm256_unpackhi_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+2]=_mm256_unpacklo_epi32(a[4*m+1],a[4*m+3]);
+    b[4*m+3]=_mm256_unpackhi_epi32(a[4*m+1],a[4*m+3]);
+  }
+  for (m=0;m<4;m++) {
+    v[2*m]  =_mm256_unpacklo_epi64(b[m],b[m+4]);
+    v[2*m+1]=_mm256_unpackhi_epi64(b[m],b[m+4]);
+  }
+}
+
+
+
+__attribute__((target("avx2")))
+static inline __m256i widenAVX2(const int8_t *input)
+{
+  return _mm256_cvtepi8_epi16(
+	   _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)input),
+			      _mm_loadl_epi64((const __m128i*)(input+8*ENVELOPE_BLOCK))));
+}
+
+
+
+__attribute__((target("avx2")))
+void correctEnvelopeAVX2(int8_t *buffer,int32_t from,int32_t to)
+{
+  int8_t  input[16*ENVELOPE_BLOCK+1];
+  __m256i v[8],level,sum,bytes;
+  __m256i seventh = _mm256_set1_epi16(9363);
+  int8_t *output;
+  int32_t i,k;
+  int     m;
+
+  for (i=from;i+16*ENVELOPE_BLOCK<=to;i+=16*ENVELOPE_BLOCK) {
+
+    memcpy(input,buffer+i,sizeof(input));
+    level=_mm256_setzero_si256();
+
+    for (k=0;k<ENVELOPE_BLOCK;k+=8) {
+
+      for (m=0;m<8;m++)
+	v[m]=_mm256_add_epi16(_mm256_slli_epi16(widenAVX2(input+m*ENVELOPE_BLOCK+k),1),
+			      _mm256_slli_epi16(widenAVX2(input+m*ENVELOPE_BLOCK+k+1),2));
+      transposeAVX2(v);
+
+      for (m=0;m<8;m++) {
+	sum=_mm256_add_epi16(level,v[m]);
+	level=_mm256_add_epi16(_mm256_mulhi_epi16(sum,seventh),
+			       _mm256_srli_epi16(sum,15));
+	v[m]=level;
+      }
+
+      transposeAVX2(v);
+      for (m=0;m<8;m++) {
+	output=buffer+i+m*ENVELOPE_BLOCK+k;
+	bytes=_mm256_packs_epi16(v[m],v[m]);
+	_mm_storel_epi64((__m128i*)output,_mm256_castsi256_si128(bytes));
+	_mm_storel_epi64((__m128i*)(output+8*ENVELOPE_BLOCK),
+			 _mm256_extracti128_si256(bytes,1));
+      }
+    }
+
+    fixEnvelope(buffer+i,input,16);
+  }
+
+  correctEnvelope(buffer,i,to);
+}
+
+
+
+__attribute__((target("avx2")))
+static inline __m256i scaleAVX2(__m256i x,__m256 factor)
+{
+  __m256i d[4];
+  __m256i order = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+  __m128i half;
+  int m;
+
+  for (m=0;m<4;m++) {
+    half= m<2 ? _mm256_castsi256_si128(x) : _mm256_extracti128_si256(x,1);
+    if (m&1) half=_mm_srli_si128(half,8);
+    d[m]=_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(half)),
+					   factor));
+  }
+
+  /* packing works per 128 bit lane, put the results back in order */
+  return _mm256_permutevar8x32_epi32(
+	   _mm256_packs_epi16(_mm256_packs_epi32(d[0],d[1]),
+			      _mm256_packs_epi32(d[2],d[3])),order);
+}
+
+
+
+__attribute__((target("avx2")))
+void prepareSamplesAVX2(TAPE *tape, const uint8_t *frames, int8_t *buffer,
+			int32_t count, float scale)
+{
+  const __m256i *src;
+  __m256i x,flip,bias;
+  __m256  factor = _mm256_set1_ps(scale);
+  __m256i order  = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+  int32_t i;
+
+  if (tape->format!=WAVE_FORMAT_PCM || tape->source!=DECODER_RIGHT ||
+      (tape->align!=1 && tape->align!=2 && tape->align!=4)) {
+    prepareSamples(tape,frames,buffer,count,scale);
+    return;
+  }
+
+  flip=_mm256_set1_epi8(tape->phase ? -1 : 0);
+  bias=_mm256_set1_epi8(tape->bits==8 ? -128 : 0);
+
+  for (i=0;i+32<=count;i+=32) {
+
+    src=(const __m256i*)(frames+i*tape->align);
+
+    if (tape->align==1) x=_mm256_loadu_si256(src);
+    else if (tape->align==2)
+      x=_mm256_permute4x64_epi64(
+	  _mm256_packus_epi16(_mm256_srli_epi16(_mm256_loadu_si256(src),8),
+			      _mm256_srli_epi16(_mm256_loadu_si256(src+1),8)),0xD8);
+    else
+      x=_mm256_permutevar8x32_epi32(
+	  _mm256_packus_epi16(
+	    _mm256_packs_epi32(_mm256_srli_epi32(_mm256_loadu_si256(src),24),
+			       _mm256_srli_epi32(_mm256_loadu_si256(src+1),24)),
+	    _mm256_packs_epi32(_mm256_srli_epi32(_mm256_loadu_si256(src+2),24),
+			       _mm256_srli_epi32(_mm256_loadu_si256(src+3),24))),order);
+
+    x=_mm256_xor_si256(x,bias);
+    x=_mm256_sub_epi8(_mm256_xor_si256(x,flip),flip);
+    if (scale>0) x=scaleAVX2(x,factor);
+
+    _mm256_storeu_si256((__m256i*)(buffer+i),x);
+  }
+
+  prepareSamples(tape,frames+i*tape->align,buffer+i,count-i,scale);
+}
+
+
+
+__attribute__((target("avx2")))
+int peakLevelAVX2(const int8_t *buffer,int32_t size)
+{
+  __m256i peak = _mm256_setzero_si256();
+  uint8_t levels[32];
+  int32_t i;
+  int     maximum;
+
+  for (i=0;i+32<=size;i+=32)
+    peak=_mm256_max_epu8(peak,
+			 _mm256_abs_epi8(_mm256_loadu_si256((const __m256i*)(buffer+i))));
+
+  maximum=peakLevel(buffer+i,size-i);
+  _mm256_storeu_si256((__m256i*)levels,peak);
+  for (i=0;i<32;i++) if (levels[i]>maximum) maximum=levels[i];
+
+  return maximum;
+}
+
+
+
+__attribute__((target("avx2")))
+void flagLoudAVX2(const int8_t *buffer,uint64_t *loud,int32_t words,
+		  int threshold)
+{
+  __m256i x,high,low;
+  uint64_t word;
+  int32_t i;
+  int     m;
+
+  if (threshold<=0 || threshold>128) {
+    flagLoud(buffer,loud,words,threshold);
+    return;
+  }
+
+  high=_mm256_set1_epi8(threshold-1);
+  low=_mm256_set1_epi8(1-threshold);
+
+  for (i=0;i<words;i++) {
+
+    word=0;
+    for (m=0;m<2;m++) {
+      x=_mm256_loadu_si256((const __m256i*)(buffer+64*i+32*m));
+      word|=(uint64_t)(uint32_t)
+	_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(x,high),
+					     _mm256_cmpgt_epi8(low,x)))<<(32*m);
+    }
+    loud[i]=word;
+  }
+}
+
+
+
+__attribute__((target("avx2")))
+void correlateTonesAVX2(const int8_t *samples,const int16_t *tones,
+			int32_t count,int32_t *sums)
+{
+  __m256i x,total[4];
+  int32_t i,rest[4];
+  int32_t lanes[8];
+  int     k,m;
+
+  for (k=0;k<4;k++) total[k]=_mm256_setzero_si256();
+
+  /* 16 samples at a time */
+  for (i=0;i+16<=count;i+=16) {
+    x=_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(samples+i)));
+    for (k=0;k<4;k++)
+      total[k]=_mm256_add_epi32(total[k],
+		 _mm256_madd_epi16(x,_mm256_loadu_si256((const __m256i*)
+							(tones+k*TONE_SIZE+i))));
+  }
+
+  correlateTones(samples+i,tones+i,count-i,rest);
+
+  for (k=0;k<4;k++) {
+    _mm256_storeu_si256((__m256i*)lanes,total[k]);
+    sums[k]=rest[k];
+    for (m=0;m<8;m++) sums[k]+=lanes[m];
+  }
+}
+
+
+
+/* AVX-512: 32 blocks per vector, blocks m, m+8, m+16 and m+24 share a row */
+__attribute__((target("avx512bw")))
+static inline void transposeAVX512(__m512i *v)
+{
+  __m512i a[8],b[8];
+  int m;
+
+  for (m=0;m<4;m++) {
+    a[2*m]  =_mm512_unpacklo_epi16(v[2*m],v[2*m+1]);
+    a[2*m+1]=_mm512_unpackhi_epi16(v[2*m],v[2*m+1]);
+  }
+  for (m=0;m<2;m++) {
+    b[4*m]  =_mm512_unpacklo_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+1]=_mm512_unpackhi_epi32(a[4*m],  a[4*m+2]);
+    b[4*m+2]=_mm512_unpacklo_epi32(a[4*m+1],a[4*m+3]);
+    b[4*m+3]=_mm512_unpackhi_epi32(a[4*m+1],a[4*m+3]);
+  }
+  for (m=0;m<4;m++) {
+    v[2*m]  =_mm512_unpacklo_epi64(b[m],b[m+4]);
+    v[2*m+1]=_mm512_unpackhi_epi64(b[m],b[m+4]);
+  }
+}
+
+
+
+__attribute__((target("avx512bw")))
+static inline __m512i widenAVX512(const int8_t *input)
+{
+  __m128i low,high;
+
+  low =_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)input),
+			  _mm_loadl_epi64((const __m128i*)(input+8*ENVELOPE_BLOCK)));
+  high=_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(input+16*ENVELOPE_BLOCK)),
+			  _mm_loadl_epi64((const __m128i*)(input+24*ENVELOPE_BLOCK)));
+
+  return _mm512_cvtepi8_epi16(_mm256_inserti128_si256(_mm256_castsi128_si256(low),
+						      high,1));
+}
+
+
+
+__attribute__((target("avx512bw")))
+void correctEnvelopeAVX512(int8_t *buffer,int32_t from,int32_t to)
+{
+  int8_t  input[32*ENVELOPE_BLOCK+1];
+  __m512i v[8],level,sum;
+  __m512i seventh = _mm512_set1_epi16(9363);
+  __m256i bytes;
+  __m128i half;
+  int8_t *output;
+  int32_t i,k;
+  int     m;
+
+  for (i=from;i+32*ENVELOPE_BLOCK<=to;i+=32*ENVELOPE_BLOCK) {
+
+    memcpy(input,buffer+i,sizeof(input));
+    level=_mm512_setzero_si512();
+
+    for (k=0;k<ENVELOPE_BLOCK;k+=8) {
+
+      for (m=0;m<8;m++)
+	v[m]=_mm512_add_epi16(_mm512_slli_epi16(widenAVX512(input+m*ENVELOPE_BLOCK+k),1),
+			      _mm512_slli_epi16(widenAVX512(input+m*ENVELOPE_BLOCK+k+1),2));
+      transposeAVX512(v);
+
+      for (m=0;m<8;m++) {
+	sum=_mm512_add_epi16(level,v[m]);
+	level=_mm512_add_epi16(_mm512_mulhi_epi16(sum,seventh),
+			       _mm512_srli_epi16(sum,15));
+	v[m]=level;
+      }
+
+      transposeAVX512(v);
+      for (m=0;m<8;m++) {
+	output=buffer+i+m*ENVELOPE_BLOCK+k;
+	bytes=_mm512_cvtepi16_epi8(v[m]);
+	half=_mm256_castsi256_si128(bytes);
+	_mm_storel_epi64((__m128i*)output,half);
+	_mm_storel_epi64((__m128i*)(output+8*ENVELOPE_BLOCK),_mm_srli_si128(half,8));
+	half=_mm256_extracti128_si256(bytes,1);
+	_mm_storel_epi64((__m128i*)(output+16*ENVELOPE_BLOCK),half);
+	_mm_storel_epi64((__m128i*)(output+24*ENVELOPE_BLOCK),_mm_srli_si128(half,8));
+      }
+    }
+
+    fixEnvelope(buffer+i,input,32);
+  }
+
+  correctEnvelope(buffer,i,to);
+}
+
+
+
+__attribute__((target("avx512bw")))
+void prepareSamplesAVX512(TAPE *tape, const uint8_t *frames, int8_t *buffer,
+			int32_t count, float scale)
+{
+  const uint8_t *src;
+  __m128i x,flip,bias;
+  __m512  factor = _mm512_set1_ps(scale);
+  int32_t i;
+
+  if (tape->format!=WAVE_FORMAT_PCM || tape->source!=DECODER_RIGHT ||
+      (tape->align!=1 && tape->align!=2 && tape->align!=4)) {
+    prepareSamples(tape,frames,buffer,count,scale);
+    return;
+  }
+
+  flip=_mm_set1_epi8(tape->phase ? -1 : 0);
+  bias=_mm_set1_epi8(tape->bits==8 ? -128 : 0);
+
+  /* 16 samples at a time, so each fits a vector of 32 bit values */
+  for (i=0;i+16<=count;i+=16) {
+
+    src=frames+i*tape->align;
+
+    if (tape->align==1) x=_mm_loadu_si128((const __m128i*)src);
+    else if (tape->align==2)
+      x=_mm512_cvtepi32_epi8(_mm512_srli_epi32(
+	  _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)src)),8));
+    else
+      x=_mm512_cvtepi32_epi8(_mm512_srli_epi32(_mm512_loadu_si512((const void*)src),24));
+
+    x=_mm_xor_si128(x,bias);
+    x=_mm_sub_epi8(_mm_xor_si128(x,flip),flip);
+    if (scale>0)
+      x=_mm512_cvtsepi32_epi8(_mm512_cvttps_epi32(
+	  _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(x)),factor)));
+
+    _mm_storeu_si128((__m128i*)(buffer+i),x);
+  }
+
+  prepareSamples(tape,frames+i*tape->align,buffer+i,count-i,scale);
+}
+
+
+
+__attribute__((target("avx512bw")))
+int peakLevelAVX512(const int8_t *buffer,int32_t size)
+{
+  __m512i peak = _mm512_setzero_si512();
+  uint8_t levels[64];
+  int32_t i;
+  int     maximum;
+
+  for (i=0;i+64<=size;i+=64)
+    peak=_mm512_max_epu8(peak,
+			 _mm512_abs_epi8(_mm512_loadu_si512((const void*)(buffer+i))));
+
+  maximum=peakLevel(buffer+i,size-i);
+  _mm512_storeu_si512((void*)levels,peak);
+  for (i=0;i<64;i++) if (levels[i]>maximum) maximum=levels[i];
+
+  return maximum;
+}
+
+
+
+__attribute__((target("avx512bw")))
+void flagLoudAVX512(const int8_t *buffer,uint64_t *loud,int32_t words,
+		    int threshold)
+{
+  __m512i x,high,low;
+  int32_t i;
+
+  if (threshold<=0 || threshold>128) {
+    flagLoud(buffer,loud,words,threshold);
+    return;
+  }
+
+  high=_mm512_set1_epi8(threshold-1);
+  low=_mm512_set1_epi8(1-threshold);
+
+  for (i=0;i<words;i++) {
+    x=_mm512_loadu_si512((const void*)(buffer+64*i));
+    loud[i]=_mm512_cmpgt_epi8_mask(x,high) | _mm512_cmpgt_epi8_mask(low,x);
+  }
+}
+
+#endif
+
+
+
+/* pick the fastest kernels the cpu supports */
+void selectKernels(void)
+{
+#ifdef SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2")) {
+    envelopeKernel=correctEnvelopeSSE2;
+    prepareKernel=prepareSamplesSSE2;
+    peakKernel=peakLevelSSE2;
+    loudKernel=flagLoudSSE2;
+    toneKernel=correlateTonesSSE2;
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    envelopeKernel=correctEnvelopeAVX2;
+    prepareKernel=prepareSamplesAVX2;
+    peakKernel=peakLevelAVX2;
+    loudKernel=flagLoudAVX2;
+    toneKernel=correlateTonesAVX2;
+  }
+
+  if (__builtin_cpu_supports("avx512bw")) {
+    envelopeKernel=correctEnvelopeAVX512;
+    prepareKernel=prepareSamplesAVX512;
+    peakKernel=peakLevelAVX512;
+    loudKernel=flagLoudAVX512;
+  }
+#endif
+}
+
+
+
+/* read and convert up to READ_SIZE sample frames, starting at frame */
+int32_t readFrames(TAPE *tape, int64_t frame, int8_t *buffer, int32_t count,
+		   float scale)
+{
+  int64_t end;
+
+  if (tape->map) {
+
+    prepareKernel(tape,tape->map+tape->offset+frame*tape->align,
+		  buffer,count,scale);
+
+    /* drop the pages that are converted already */
+    #ifdef MMAP
+    end=(tape->offset+(frame+count)*tape->align) & ~(int64_t)(MAP_PAGES-1);
+    if (end>tape->mapped && !tape->memory) {
+      madvise(tape->map+tape->mapped,end-tape->mapped,MADV_DONTNEED);
+      tape->mapped=end;
+    }
+    #endif
+
+    return count;
+  }
+
+  count=fread(tape->frames,tape->align,count,tape->file);
+  prepareKernel(tape,tape->frames,buffer,count,scale);
+
+  return count;
+}
+
+
+
+/* read a chunk of samples from the wav file */
+int32_t readSamples(TAPE *tape, int8_t *buffer, int32_t count)
+{
+  int factor = tape->factor;
+
+  if (count>tape->size-tape->read) count=tape->size-tape->read;
+  if (count>READ_SIZE/factor) count=READ_SIZE/factor;
+
+  if (factor==1)
+    return readFrames(tape,tape->read,buffer,count,tape->scale);
+
+  /* the level is scaled after filtering, as if the signal was */
+  /* sampled at the lower rate in the first place              */
+  count=readFrames(tape,tape->read*factor,tape->input+factor-1,
+		   count*factor,0)/factor;
+  decimateSamples(tape->input,buffer,count,factor);
+  memmove(tape->input,tape->input+count*factor,factor-1);
+  if (tape->scale>0) normalizeAmplitude(buffer,count,tape->scale);
+
+  return count;
+}
+
+
+
+/* parse the contents of a fmt chunk */
+bool parseFormat(TAPE *tape, uint8_t *fmt, uint32_t size,
+		 int *channels, int *frequency)
+{
+  /* at least a plain WAVEFORMAT structure is needed */
+  if (size<14) return false;
+
+  tape->format=GETSHORT(fmt);
+  *channels=GETSHORT(fmt+2);
+  *frequency=GETLONG(fmt+4);
+  tape->align=GETSHORT(fmt+12);
+  tape->bits= size>=16 ? GETSHORT(fmt+14) : 0;
+
+  /* the real format tag is the start of the sub format guid */
+  if (tape->format==WAVE_FORMAT_EXTENSIBLE && size>=26)
+    tape->format=GETSHORT(fmt+24);
+
+  /* be forgiving about the size fields */
+  if (*channels<1) *channels=1;
+  if (tape->bits==0 && tape->align>0) tape->bits=8*(tape->align / *channels);
+  if (tape->bits==0) tape->bits=8;
+  if (tape->align < *channels*((tape->bits+7)/8))
+    tape->align=*channels*((tape->bits+7)/8);
+
+  return true;
+}
+
+
+
+/* release the tape image */
+void tapeClose(TAPE *tape)
+{
+  #ifdef MMAP
+  if (tape->map && !tape->shared && !tape->memory)
+    munmap(tape->map,tape->length);
+  #endif
+  if (tape->file && !tape->stream) fclose(tape->file);
+  free(tape->buffer);
+  free(tape->frames);
+  free(tape->pass);
+  free(tape->pulses);
+  free(tape->loud);
+  free(tape->input);
+  free(tape->tones);
+}
+
+
+
+/* restart reading at sample start, the tape ends at sample end */
+void tapeSeek(TAPE *tape, int64_t start, int64_t end)
+{
+  int p;
+
+  tape->size=end;
+  tape->read=tape->ready=tape->base=tape->indexed=tape->cursor=start;
+  tape->pulsecount=tape->pulsebase=0;
+
+  /* the first sample is never touched by the envelope correction */
+  for (p=0;p<tape->envelope;p++) tape->pass[p]=start+1;
+
+  /* the decimation filter starts from silence */
+  if (tape->input) memset(tape->input,0,tape->factor-1);
+
+  start*=(int64_t)tape->factor*tape->align;
+  tape->mapped=(tape->offset+start) & ~(int64_t)(MAP_PAGES-1);
+  if (!tape->map && !tape->stream) fseek(tape->file,tape->offset+start,SEEK_SET);
+}
+
+
+
+/* allocate the window on the sample data and start at the beginning */
+bool tapeAlloc(TAPE *tape)
+{
+  tape->buffer=(int8_t*)malloc(WINDOW_SIZE*sizeof(int8_t));
+  tape->frames=tape->map ? NULL : (uint8_t*)malloc(READ_SIZE*tape->align);
+  tape->pass=(int64_t*)malloc((tape->envelope+1)*sizeof(int64_t));
+  tape->pulses=(PULSE*)malloc(PULSE_WINDOW*sizeof(PULSE));
+  tape->loud=(uint64_t*)malloc(WINDOW_SIZE/64*sizeof(uint64_t));
+  if (tape->factor>1)
+    tape->input=(int8_t*)malloc(READ_SIZE+tape->factor);
+  if (tape->engine==DECODER_TONES)
+    tape->tones=(int16_t*)malloc(4*TONE_SIZE*sizeof(int16_t));
+  tape->cell=0;
+
+  if (tape->buffer==NULL || tape->pass==NULL || tape->pulses==NULL ||
+      tape->loud==NULL || (tape->factor>1 && tape->input==NULL) ||
+      (tape->engine==DECODER_TONES && tape->tones==NULL) ||
+      (tape->map==NULL && tape->frames==NULL)) {
+    tapeClose(tape);
+    return false;
+  }
+
+  tapeSeek(tape,0,tape->size);
+
+  return true;
+}
+
+
+
+/* read bytes of the wav file, from the map or from the file */
+bool tapeRead(TAPE *tape, int64_t offset, uint8_t *data, int32_t count)
+{
+  if (tape->map) {
+
+    if (offset+count>tape->length) return false;
+    memcpy(data,tape->map+offset,count);
+    return true;
+  }
+
+  fseek(tape->file,offset,SEEK_SET);
+  return fread(data,1,count,tape->file)==count;
+}
+
+
+
+/* check the format of the samples and get ready to decode them */
+int tapeFormat(TAPE *tape, const DECODER_SETTINGS *settings, bool found,
+	       int channels, int frequency, FILE *errors)
+{
+  int  rate;
+
+  tape->threshold=settings->threshold;
+  tape->envelope=settings->envelope;
+  tape->phase=settings->phase;
+  tape->window=settings->window;
+  tape->engine=settings->engine;
+  tape->recover=settings->recover;
+
+  if (!found) {
+    tape->guessed=true;
+    tape->format=WAVE_FORMAT_PCM;
+    tape->bits=8; tape->align=1;
+    channels=1; frequency=43200;
+  }
+
+  if (!(tape->format==WAVE_FORMAT_PCM && tape->bits<=32) &&
+      !(tape->format==WAVE_FORMAT_IEEE_FLOAT && tape->bits==32)) {
+    logMessage(errors,"Unsupported wav format!\n");
+    tapeClose(tape);
+    return -1;
+  }
+
+  tape->channels=channels;
+  tape->size/=tape->align;
+
+  /* decimate by the largest whole factor that keeps at least rate */
+  rate=settings->rate;
+  tape->factor = rate>0 && frequency/rate>1 ? frequency/rate : 1;
+  tape->frequency=frequency/tape->factor;
+  tape->size/=tape->factor;
+  tape->silence=(int64_t)tape->frequency*THRESHOLD_SILENCE/1000000;
+  if (tape->silence<1) tape->silence=1;
+
+  /* streams are processed as soon as a fraction of a second is there */
+  tape->tile=TILE_SIZE;
+  if (tape->stream && tape->frequency/LIVE_TILES<TILE_SIZE)
+    tape->tile= tape->frequency/LIVE_TILES<64 ? 64 : tape->frequency/LIVE_TILES;
+
+  /* offset of the last channel, or its most significant byte */
+  tape->channel=tape->align-tape->align/channels;
+  if (tape->format==WAVE_FORMAT_PCM) tape->channel+=tape->align/channels-1;
+  tape->first=tape->channel-(tape->align-tape->align/channels);
+  tape->source=DECODER_RIGHT;
+
+  if (!tapeAlloc(tape)) {
+    logMessage(errors,"Not enough memory!\n");
+    return -1;
+  }
+
+  return frequency;
+}
+
+
+
+/* read the format of the wav data and get ready to decode it */
+int tapeStart(TAPE *tape, const DECODER_SETTINGS *settings, FILE *errors)
+{
+  uint8_t  chunk[12],fmt[40];
+  uint32_t size;
+  int64_t  pos,data;
+  int32_t  count;
+  int  channels,frequency;
+  bool found;
+
+  if (!tapeRead(tape,0,chunk,12) ||
+      memcmp(chunk,"RIFF",4) || memcmp(chunk+8,"WAVE",4)) {
+    logMessage(errors,"Incorrect wav header!\n");
+    tapeClose(tape);
+    return -1;
+  }
+
+  /* walk the chunks by their declared sizes, the fmt chunk could be */
+  /* missing or even follow the data chunk in odd files              */
+  found = false;
+  frequency = 0;
+  data = -1;
+  pos = 12;
+  while (pos+8<=tape->length && (data<0 || !found)) {
+
+    if (!tapeRead(tape,pos,chunk,8)) break;
+    size=GETLONG(chunk+4);
+
+    if (!memcmp(chunk,"fmt ",4) && !found) {
+
+      count = size<sizeof(fmt) ? size : sizeof(fmt);
+      if (tapeRead(tape,pos+8,fmt,count))
+	found=parseFormat(tape,fmt,count,&channels,&frequency);
+    }
+
+    if (!memcmp(chunk,"data",4) && data<0) {
+
+      data=pos+8;
+      /* streamed files often have a bogus data size */
+      if (size==0 || data+size>tape->length) size=tape->length-data;
+      tape->size=size;
+    }
+
+    /* chunks are word aligned */
+    pos+=8+(int64_t)size+(size&1);
+  }
+
+  /* Basic error handling */
+  if (data<0) {
+    logMessage(errors,"Incorrect wav header!\n");
+    tapeClose(tape);
+    return -1;
+  }
+
+  tape->offset=data;
+
+  return tapeFormat(tape,settings,found,channels,frequency,errors);
+}
+
+
+
+/* Open wav file for tape image */
+int tapeOpen(char* szFileName, TAPE *tape, const DECODER_SETTINGS *settings,
+	     FILE *errors)
+{
+  FILE*    wav_file;
+
+  if ((wav_file=fopen(szFileName,"rb"))==NULL) return -1;
+
+  memset(tape,0,sizeof(TAPE));
+  tape->file=wav_file;
+  tape->name=szFileName;
+
+  fseek(wav_file,0,SEEK_END);
+  tape->length=ftell(wav_file);
+  fseek(wav_file,0,SEEK_SET);
+
+  /* map the whole file if possible, otherwise read it in chunks */
+  #ifdef MMAP
+  tape->map=(uint8_t*)mmap(NULL,tape->length,PROT_READ,MAP_PRIVATE,
+			   fileno(wav_file),0);
+  if (tape->map==MAP_FAILED) tape->map=NULL;
+  else madvise(tape->map,tape->length,MADV_SEQUENTIAL);
+  #endif
+
+  return tapeStart(tape,settings,errors);
+}
+
+
+
+/* use a wav file in memory for tape image, it is never copied */
+int tapeOpenMemory(const uint8_t *wav, int64_t length, TAPE *tape,
+		   const DECODER_SETTINGS *settings, FILE *errors)
+{
+  memset(tape,0,sizeof(TAPE));
+  tape->map=(uint8_t*)wav;
+  tape->memory=true;
+  tape->length=length;
+
+  return tapeStart(tape,settings,errors);
+}
+
+
+
+/* use a stream (like a pipe) for tape image, it is read once from start */
+/* to end. Without a frequency it starts with a wav header, otherwise it */
+/* is raw PCM                                                             */
+int tapeOpenStream(FILE *stream, TAPE *tape, const DECODER_SETTINGS *settings,
+		   int frequency, int bits, int channels, FILE *errors)
+{
+  uint8_t  chunk[12],fmt[40];
+  uint32_t size,count;
+  int64_t  skip;
+  bool     found = false;
+
+  memset(tape,0,sizeof(TAPE));
+  tape->file=stream;
+  tape->stream=true;
+  tape->size=STREAM_SIZE;
+
+  if (frequency>0) {
+    tape->format=WAVE_FORMAT_PCM;
+    tape->bits=bits;
+    tape->align=channels*((bits+7)/8);
+    return tapeFormat(tape,settings,true,channels,frequency,errors);
+  }
+
+  if (fread(chunk,1,12,stream)!=12 ||
+      memcmp(chunk,"RIFF",4) || memcmp(chunk+8,"WAVE",4)) {
+    logMessage(errors,"Incorrect wav header!\n");
+    tapeClose(tape);
+    return -1;
+  }
+
+  /* the chunks can only be read in order, the samples follow the data */
+  /* chunk so the fmt chunk has to come before it                      */
+  for (;;) {
+
+    if (fread(chunk,1,8,stream)!=8) {
+      logMessage(errors,"Incorrect wav header!\n");
+      tapeClose(tape);
+      return -1;
+    }
+
+    size=GETLONG(chunk+4);
+    if (!memcmp(chunk,"data",4)) break;
+
+    count=0;
+    if (!memcmp(chunk,"fmt ",4) && !found) {
+
+      count = size<sizeof(fmt) ? size : sizeof(fmt);
+      if (fread(fmt,1,count,stream)==count)
+	found=parseFormat(tape,fmt,count,&channels,&frequency);
+    }
+
+    /* chunks are word aligned */
+    for (skip=(int64_t)size+(size&1)-count;skip>0;skip--)
+      if (getc(stream)==EOF) break;
+  }
+
+  /* streamed files often have no data size */
+  if (size>0 && size<0xFFFFFFFF) tape->size=size;
+
+  return tapeFormat(tape,settings,found,channels,frequency,errors);
+}
+
+
+
+/* open another window on the sample data of a tape, with the settings */
+/* of that tape. The mapped file is shared, it is never read twice     */
+int tapeClone(TAPE *tape, TAPE *source)
+{
+  *tape=*source;
+  tape->shared= tape->map!=NULL;
+  tape->buffer=NULL; tape->frames=NULL; tape->input=NULL;
+  tape->pass=NULL; tape->pulses=NULL; tape->loud=NULL; tape->tones=NULL;
+
+  tape->file= tape->map ? NULL : fopen(tape->name,"rb");
+  if (tape->map==NULL && tape->file==NULL) return -1;
+
+  if (!tapeAlloc(tape)) return -1;
+
+  return tape->frequency;
+}
+
+
+
+/* normalizing needs the peak level up front, scan the file once */
+float tapeScale(TAPE *tape)
+{
+  int32_t count;
+  int maximum = 0;
+  int level;
+
+  tapeSeek(tape,0,tape->size);
+  while ((count=readSamples(tape,tape->buffer,WINDOW_SIZE))>0) {
+    level=peakKernel(tape->buffer,count);
+    if (level>maximum) maximum=level;
+    tape->read+=count;
+  }
+  tapeSeek(tape,0,tape->size);
+
+  /* nothing to scale in a silent file */
+  return maximum ? 127/(float)maximum : 1;
+}
+
+
+
+/* flag which samples are loud, one bit per sample */
+void indexLoud(const int8_t *buffer, uint64_t *loud, int32_t count,
+	       int threshold)
+{
+  loudKernel(buffer,loud,count/64,threshold);
+  if (count&63)
+    loud[count/64]=loudSamples(buffer+(count&~63),count&63,threshold);
+}
+
+
+
+/* index which samples are loud, one bit per sample */
+void indexSilence(TAPE *tape)
+{
+  int64_t start;
+
+  /* the last word is indexed again when more samples are available */
+  start=tape->indexed&~63;
+  indexLoud(tape->buffer+(start-tape->base),tape->loud+(start-tape->base)/64,
+	    tape->ready-start,tape->threshold);
+
+  tape->indexed=tape->ready;
+}
+
+
+
+/* process samples until index is available in the window */
+void tapeFill(TAPE *tape, int64_t index)
+{
+  int64_t shift,input;
+  int32_t count;
+  int     p;
+  TIMER   timer;
+
+  while (index>=tape->ready && tape->ready<tape->size) {
+
+    /* window is full, drop the oldest half but keep what the filter needs */
+    if (tape->read-tape->base==WINDOW_SIZE) {
+
+      shift=WINDOW_SIZE/2;
+      for (p=0;p<tape->envelope;p++)
+	if (tape->pass[p]-1-tape->base<shift) shift=tape->pass[p]-1-tape->base;
+
+      /* keep the silence index word aligned */
+      shift&=~63;
+
+      memmove(tape->buffer,tape->buffer+shift,WINDOW_SIZE-shift);
+      memmove(tape->loud,tape->loud+shift/64,(WINDOW_SIZE-shift)/64*sizeof(uint64_t));
+      tape->base+=shift;
+    }
+
+    /* convert, phase shift and normalize a tile, then run all envelope */
+    /* passes over it. Each pass stops one sample short of the one     */
+    /* before it, that sample is finished together with the next tile  */
+    count=WINDOW_SIZE-(tape->read-tape->base);
+    if (count>tape->tile) count=tape->tile;
+    startTimer(tape->stats,&timer);
+    count=readSamples(tape,tape->buffer+(tape->read-tape->base),count);
+    stopTimer(tape->stats,&timer,STAGE_INGEST);
+
+    /* truncated file */
+    if (count==0) tape->size=tape->read;
+
+    tape->read+=count;
+
+    /* remember when the samples of a stream came in */
+    if (tape->stream) {
+      tape->arrived[tape->arrivals%ARRIVALS]=tape->read;
+      tape->arrival[tape->arrivals%ARRIVALS]=wallClock();
+      tape->arrivals++;
+    }
+    if (tape->stats) tape->stats->samples+=count;
+
+    /* run each envelope pass as far as its input is complete */
+    startTimer(tape->stats,&timer);
+    input=tape->read;
+    for (p=0;p<tape->envelope;p++) {
+
+      if (tape->pass[p]<input-1) {
+	envelopeKernel(tape->buffer,
+		       tape->pass[p]-tape->base,
+		       input-1-tape->base);
+	tape->pass[p]=input-1;
+      }
+
+      /* the last sample is never touched by the envelope correction */
+      if (input<tape->size && tape->pass[p]<input) input=tape->pass[p];
+    }
+    tape->ready=input;
+    stopTimer(tape->stats,&timer,STAGE_ENVELOPE);
+
+    startTimer(tape->stats,&timer);
+    indexSilence(tape);
+    stopTimer(tape->stats,&timer,STAGE_INGEST);
+  }
+}
+
+
+
+/* seconds since a sample came in from a stream, 0 for files */
+double tapeLatency(TAPE *tape, int64_t index)
+{
+  int64_t i,slot;
+
+  if (tape->arrivals==0) return 0;
+
+  /* the oldest read remembered that has the sample */
+  i= tape->arrivals<ARRIVALS ? 0 : tape->arrivals-ARRIVALS;
+  for (;i<tape->arrivals-1;i++)
+    if (tape->arrived[i%ARRIVALS]>index) break;
+
+  slot=i%ARRIVALS;
+  return wallClock()-tape->arrival[slot];
+}
+
+
+
+/* get a sample from the window */
+static inline int tapeSample(TAPE *tape, int64_t index)
+{
+  if (index>=tape->ready) tapeFill(tape,index);
+  if (index<tape->base || index>=tape->ready) return 0;
+
+  return tape->buffer[index-tape->base];
+}
+
+
+
+/* find the first loud sample from index on, or return end */
+int64_t nextLoud(TAPE *tape, int64_t index, int64_t end)
+{
+  uint64_t word;
+
+  while (index<end) {
+
+    if (index>=tape->indexed) tapeFill(tape,index);
+    if (index<tape->base || index>=tape->indexed) return index;
+
+    /* a whole word of samples is checked at once */
+    word=tape->loud[(index-tape->base)/64]>>(index&63);
+    if (word) {
+      index+=__builtin_ctzll(word);
+      return index<end ? index : end;
+    }
+
+    index=(index|63)+1;
+    if (index>tape->indexed) index=tape->indexed;
+  }
+
+  return end;
+}
+
+
+
+/* detect silence */
+bool isSilence(TAPE *tape,int64_t index)
+{
+  int64_t end = index+tape->silence;
+
+  if (end>tape->size) end=tape->size;
+
+  return nextLoud(tape,index,end)==end;
+}
+
+
+
+/* skip silent parts */
+void skipSilence(TAPE *tape, int64_t *index)
+{
+  int sample;
+
+  while(*index<tape->size) {
+
+    /* the index only holds samples beyond the threshold, samples */
+    /* right at the threshold level are skipped one by one        */
+    *index=nextLoud(tape,*index,tape->size);
+    if (*index>=tape->size) break;
+
+    sample=tapeSample(tape,*index);
+    if (sample > tape->threshold || sample < -tape->threshold) break;
+    (*index)++;
+  }
+}
+
+
+
+/* find the first quiet sample from index on, or return limit */
+int64_t nextQuiet(TAPE *tape, int64_t index, int64_t limit)
+{
+  uint64_t word;
+
+  while (index<limit) {
+
+    if (index>=tape->indexed) tapeFill(tape,index);
+    if (index<tape->base || index>=tape->indexed) return index;
+
+    /* skip the whole run of loud samples at once */
+    word=~(tape->loud[(index-tape->base)/64]>>(index&63));
+    index+= word ? __builtin_ctzll(word) : 64;
+
+    if (index<tape->indexed) return index<limit ? index : limit;
+  }
+
+  return limit;
+}
+
+
+
+/* find the first silent part from index on, or return limit */
+int64_t nextSilence(TAPE *tape, int64_t index, int64_t limit)
+{
+  int64_t end,loud;
+
+  /* jump from one run of loud samples to the next until there is a gap */
+  while (index<limit) {
+
+    end = index+tape->silence;
+    if (end>tape->size) end=tape->size;
+
+    if ((loud=nextLoud(tape,index,end))==end) return index;
+    index=nextQuiet(tape,loud,limit);
+  }
+
+  return limit;
+}
+
+
+
+/* measure the pulse that starts at the cursor */
+void readPulse(TAPE *tape, PULSE *pulse)
+{
+  int64_t index = tape->cursor;
+
+  int min = 1000;
+  int max =-1000;
+  int pt  = max;
+  int sample;
+
+  int prev = index > 0 ? tapeSample(tape,index-1) : 0;
+
+  /* a pulse that long is a silence, end it while its start is still */
+  /* in the window on the samples                                     */
+  int32_t width = 0;
+  for(;index<tape->size && width<WINDOW_SIZE/4;width++) {
+
+    sample=tapeSample(tape,index);
+
+    /* ascending */
+    if (sample>prev) {
+
+      if (prev==min) {
+
+	if (pt-min>=tape->threshold) {
+
+	  while(width>1) {
+
+	    if (tapeSample(tape,index)>=pt-(pt-min)/2) break;
+	    width--; index--;
+	  }
+
+	  break;
+	}
+
+	min=1000;
+      }
+
+      if (sample>max) max=sample;
+    }
+
+
+    /* descending */
+    if (sample<prev) {
+
+      if (prev==max) {
+
+	if (max>pt) pt=max;
+	max=-1000;
+      }
+
+      if (sample<min) min=sample;
+    }
+
+    prev=sample; index++;
+  }
+
+  pulse->offset=tape->cursor;
+  pulse->width=width;
+  pulse->amplitude= pt>min ? pt-min : 0;
+
+  tape->cursor=index;
+}
+
+
+
+/* get a pulse from the pulse window, the pulses are measured on demand */
+PULSE *tapePulse(TAPE *tape, int64_t pulse)
+{
+  int64_t shift;
+
+  while (pulse>=tape->pulsecount && tape->cursor<tape->size) {
+
+    /* window is full, drop the oldest half */
+    if (tape->pulsecount-tape->pulsebase==PULSE_WINDOW) {
+
+      shift=PULSE_WINDOW/2;
+      memmove(tape->pulses,tape->pulses+shift,
+	      (PULSE_WINDOW-shift)*sizeof(PULSE));
+      tape->pulsebase+=shift;
+    }
+
+    readPulse(tape,&tape->pulses[tape->pulsecount-tape->pulsebase]);
+    tape->pulsecount++;
+  }
+
+  /* past the end of the tape */
+  if (pulse<tape->pulsebase || pulse>=tape->pulsecount) {
+
+    tape->end.offset=tape->size;
+    return &tape->end;
+  }
+
+  return &tape->pulses[pulse-tape->pulsebase];
+}
+
+
+
+/* find the pulse that contains a sample */
+int64_t findPulse(TAPE *tape, int64_t index, int64_t pulse)
+{
+  PULSE *p;
+
+  /* not measured yet, start measuring pulses right there */
+  if (index>=tape->cursor) {
+
+    tape->cursor=index;
+    return tape->pulsecount;
+  }
+
+  if (pulse<tape->pulsebase) pulse=tape->pulsebase;
+
+  while (pulse>tape->pulsebase && tapePulse(tape,pulse)->offset>index) pulse--;
+
+  p=tapePulse(tape,pulse);
+  while (p->offset<tape->size && p->offset+p->width<=index)
+    p=tapePulse(tape,++pulse);
+
+  return pulse;
+}
+
+
+
+/* get the sample offset of a pulse */
+int64_t pulseOffset(TAPE *tape, int64_t pulse)
+{
+  return tapePulse(tape,pulse)->offset;
+}
+
+
+
+/* get the width of a pulse and continue to the next one */
+int32_t getPulseWidth(TAPE *tape, int64_t *pulse)
+{
+  PULSE *p=tapePulse(tape,*pulse);
+
+  if (p->offset>=tape->size) return 0;
+
+  (*pulse)++;
+  return p->width;
+}
+
+
+
+/* check for a header at a pulse, with the rule of the original      */
+/* decoder. If there is none, index is set to where the silence after */
+/* the headerless data starts, so a stretch is probed once where it   */
+/* starts and not again at each of its pulses. This is not a detector */
+/* that follows all pulses for a header: one starting halfway through */
+/* a stretch would be found, which the original never did             */
+bool findHeader(TAPE *tape, int64_t *pulse, int64_t *index)
+{
+  int64_t next    = *pulse;
+  int32_t width;
+  int32_t pulses  = 0;
+  int32_t biggest = 0;
+
+  if (tape->stats) tape->stats->probes++;
+
+  /* skip first pulse for phase independance */
+  getPulseWidth(tape,&next);
+
+  while (pulseOffset(tape,next)<tape->size && pulses<THRESHOLD_HEADER ) {
+
+    width = getPulseWidth(tape,&next);
+    if (!biggest) biggest=width;
+    if (width>(float)biggest*tape->window) break;
+    if (width>biggest) biggest = width;
+    pulses++;
+  }
+
+  if (pulses>=THRESHOLD_HEADER) return true;
+
+  /* the data without a header is skipped up to the next silence, */
+  /* which the loud sample bitmap finds without a pulse per step    */
+  *index=nextSilence(tape,*index,tape->size);
+  return false;
+}
+
+
+
+/* skip header and return average with of a short pulse */
+float skipHeader(TAPE *tape, int64_t *pulse)
+{
+
+  int32_t  width;
+  int32_t  count   = 0;
+  float average = 0;
+
+  /* skip first pulse for phase independance */
+  getPulseWidth(tape,pulse);
+
+  while (pulseOffset(tape,*pulse)<tape->size) {
+
+    width=getPulseWidth(tape,pulse);
+
+    if (average && width>(float)average*tape->window ) {
+
+	(*pulse)--;
+	return average;
+    }
+
+    /* average=(count*average+width)/++count; */
+    count++; average=((count-1)*average+width)/count;
+  }
+
+  return average;
+}
+
+
+
+/* read a byte from the pulses */
+int readByte(TAPE *tape, int64_t *pulse, float average)
+{
+  int  bit;
+  int32_t width;
+  int  value = 0;
+  int  i;
+
+  /* start bit (long pulse) */
+  width=getPulseWidth(tape,pulse);
+  if (isSilence(tape,pulseOffset(tape,*pulse)) ||
+      width<average*tape->window) return -1;
+
+  /* data bits (lsb first) */
+  for (bit=0;bit<8;bit++) {
+
+    width=getPulseWidth(tape,pulse);
+    if (isSilence(tape,pulseOffset(tape,*pulse))) return -1;
+
+    if (width<average*tape->window) {
+
+      value+=(1<<bit);
+      getPulseWidth(tape,pulse); /* skip 2nd short pulse */
+      if (isSilence(tape,pulseOffset(tape,*pulse))) return -1;
+    }
+  }
+
+  /* two stop bits (four short pulses) */
+  for (i=0;i<3;i++) {
+
+    getPulseWidth(tape,pulse);
+    if (isSilence(tape,pulseOffset(tape,*pulse))) return -1;
+  }
+  getPulseWidth(tape,pulse);
+
+  return value;
+}
+
+
+
+/* make the tables of both tones for bits of a number of samples, the */
+/* low tone is one wave per bit and the high tone two                  */
+void toneTables(TAPE *tape, float cell)
+{
+  double phase;
+  int32_t i;
+
+  tape->cell=cell;
+  tape->cells=(int32_t)(cell+0.5);
+
+  for (i=0;i<tape->cells;i++) {
+
+    phase=2*M_PI*(i+0.5)/cell;
+    tape->tones[i]=(int16_t)lrint(TONE_SCALE*cos(phase));
+    tape->tones[TONE_SIZE+i]=(int16_t)lrint(TONE_SCALE*sin(phase));
+    tape->tones[2*TONE_SIZE+i]=(int16_t)lrint(TONE_SCALE*cos(2*phase));
+    tape->tones[3*TONE_SIZE+i]=(int16_t)lrint(TONE_SCALE*sin(2*phase));
+  }
+}
+
+
+
+/* the value of the bit that starts at a sample, by which of both tones */
+/* is strongest in it                                                    */
+int toneBit(TAPE *tape, int64_t from)
+{
+  int8_t   copy[TONE_SIZE];
+  const int8_t *samples;
+  int32_t  sums[4];
+  int64_t  low,high;
+  int32_t  i;
+
+  /* the samples are used in place when they are all in the window */
+  tapeSample(tape,from+tape->cells-1);
+  if (from>=tape->base && from+tape->cells<=tape->ready)
+    samples=tape->buffer+(from-tape->base);
+  else {
+    for (i=0;i<tape->cells;i++) copy[i]=tapeSample(tape,from+i);
+    samples=copy;
+  }
+
+  toneKernel(samples,tape->tones,tape->cells,sums);
+
+  low=(int64_t)sums[0]*sums[0]+(int64_t)sums[1]*sums[1];
+  high=(int64_t)sums[2]*sums[2]+(int64_t)sums[3]*sums[3];
+
+  return high>low;
+}
+
+
+
+/* read a byte from the tones of its bits, with the framing of readByte. */
+/* Only the start of the byte is taken from the pulses, so each byte is  */
+/* in step with the signal again                                         */
+int readByteTone(TAPE *tape, int64_t *pulse, float average)
+{
+  double  cell = 2*average;
+  double  start = pulseOffset(tape,*pulse);
+  int64_t end;
+  int     value = 0;
+  int     bit;
+
+  if (cell<2 || cell>TONE_SIZE) return -1;
+  if (tape->cell!=(float)cell) toneTables(tape,cell);
+
+  /* start bit (low tone) */
+  if (isSilence(tape,(int64_t)start) || toneBit(tape,(int64_t)start))
+    return -1;
+
+  /* data bits (lsb first) */
+  for (bit=0;bit<8;bit++) {
+
+    if (isSilence(tape,(int64_t)(start+(bit+1)*cell))) return -1;
+    value|=toneBit(tape,(int64_t)(start+(bit+1)*cell+0.5))<<bit;
+  }
+
+  /* two stop bits, like readByte they are not checked */
+  if (isSilence(tape,(int64_t)(start+9*cell)) ||
+      isSilence(tape,(int64_t)(start+10*cell))) return -1;
+
+  /* the next byte starts at the pulse that holds a quarter of its */
+  /* start bit, a long pulse is found even if the tape runs a bit  */
+  /* fast or slow                                                  */
+  end=(int64_t)(start+11.25*cell);
+  while (pulseOffset(tape,*pulse+1)<=end && pulseOffset(tape,*pulse+1)<tape->size)
+    (*pulse)++;
+  if (pulseOffset(tape,*pulse)<(int64_t)(start+10.5*cell)) (*pulse)++;
+
+  return value;
+}
+
+
+
+/* grow a buffer to hold at least size elements, pointer is the address */
+/* of the buffer. If there is not enough memory the buffer is left as   */
+/* it was and false is returned                                          */
+bool growBuffer(void *pointer, int64_t *allocated, int64_t size, size_t element)
+{
+  void   *buffer;
+  int64_t length;
+
+  if (size<=*allocated) return true;
+
+  length= size<1024 ? 1024 : 2*size;
+  memcpy(&buffer,pointer,sizeof(void*));
+  if ((buffer=realloc(buffer,length*element))==NULL) return false;
+  memcpy(pointer,&buffer,sizeof(void*));
+  *allocated=length;
+
+  return true;
+}
+
+
+
+/* show a message, or keep it for later when decoding in parallel */
+void segmentLog(SEGMENT *segment, const char *format, ...)
+{
+  va_list args;
+  int length;
+
+  va_start(args,format);
+
+  if (!segment->buffered) {
+    if (segment->messages) vfprintf(segment->messages,format,args);
+    va_end(args);
+    return;
+  }
+
+  length=vsnprintf(segment->log+segment->logged,
+		   segment->logsize-segment->logged,format,args);
+  va_end(args);
+
+  if (segment->logged+length>=segment->logsize) {
+
+    /* a message there is no memory for is left out */
+    if (!growBuffer(&segment->log,&segment->logsize,
+		    segment->logged+length+1,sizeof(char))) return;
+    va_start(args,format);
+    vsnprintf(segment->log+segment->logged,
+	      segment->logsize-segment->logged,format,args);
+    va_end(args);
+  }
+  segment->logged+=length;
+}
+
+
+
+/* add a segment to the list, the list is freed if there is no memory */
+SEGMENT *addSegment(SEGMENT *segments, int64_t *allocated, int32_t *count,
+		    int64_t start, int64_t end)
+{
+  if (!growBuffer(&segments,allocated,*count+1,sizeof(SEGMENT))) {
+    free(segments);
+    return NULL;
+  }
+
+  memset(&segments[*count],0,sizeof(SEGMENT));
+  segments[*count].start=start;
+  segments[*count].end=end;
+  segments[*count].buffered=true;
+  (*count)++;
+
+  return segments;
+}
+
+
+
+/* cut the tape at each long silence, the same way for any number of */
+/* threads so the result does not depend on it. Returns NULL if there */
+/* is not enough memory                                                */
+SEGMENT *splitTape(TAPE *tape, int32_t *total)
+{
+  SEGMENT *segments = NULL;
+  int64_t  allocated = 0;
+  int64_t  gap,start,quiet,cut;
+  uint64_t word;
+  int32_t  size,i,count,run;
+
+  /* leave room for the envelope correction to settle on both sides */
+  gap=SEGMENT_GAP+8*tape->envelope;
+
+  *total=0;
+  start=quiet=0;
+  tapeSeek(tape,0,tape->size);
+
+  while ((size=readSamples(tape,tape->buffer,WINDOW_SIZE))>0) {
+
+    indexLoud(tape->buffer,tape->loud,size,tape->threshold);
+
+    /* count the quiet samples in a row, 64 samples at a time */
+    for (i=0;i<size;i+=64) {
+
+      count= size-i<64 ? size-i : 64;
+      word=tape->loud[i/64];
+      run= word ? __builtin_ctzll(word) : count;
+
+      /* cut in the middle of the gap, keeping the silence index aligned */
+      if (quiet<gap && quiet+run>=gap) {
+
+	cut=(tape->read+i+gap-quiet-gap/2) & ~63;
+	if (cut>start) {
+	  segments=addSegment(segments,&allocated,total,start,cut);
+	  if (segments==NULL) return NULL;
+	  start=cut;
+	}
+      }
+
+      quiet= word ? count-64+__builtin_clzll(word) : quiet+count;
+    }
+
+    tape->read+=size;
+  }
+
+  return addSegment(segments,&allocated,total,start,tape->read);
+}
+
+
+
+/* add decoded data to the .cas data, false if there is no memory */
+bool writeOutput(DECODER *decoder, const uint8_t *data, int64_t length)
+{
+  if (length<=0) return true;
+
+  if (!growBuffer(&decoder->output,&decoder->size,decoder->length+length,
+		  sizeof(uint8_t))) return false;
+  memcpy(decoder->output+decoder->length,data,length);
+  decoder->length+=length;
+
+  return true;
+}
+
+
+
+/* add the decoded data of a segment that is not added yet, the segments */
+/* are added in order. Returns false if there is not enough memory      */
+bool flushSegment(DECODER *decoder, SEGMENT *segment)
+{
+  const uint8_t padding[8] = { 0 };
+  int64_t i,to;
+
+  for (i=segment->flushed;i<=segment->count;i++) {
+
+    to= i<segment->count ? segment->blocks[i] : segment->length;
+
+    if (to>segment->written) {
+      if (!writeOutput(decoder,segment->data+segment->written,
+		       to-segment->written)) return false;
+      segment->written=to;
+      decoder->header=false;
+    }
+
+    if (i==segment->count) break;
+
+    /* write .cas header if none already written */
+    if (!decoder->header) {
+
+      /* .cas headers always start at fixed positions */
+      if (!writeOutput(decoder,padding,-decoder->length&7) ||
+	  !writeOutput(decoder,(const uint8_t*)HEADER,8)) return false;
+      decoder->header=true;
+    }
+
+    segment->flushed=i+1;
+  }
+
+  return true;
+}
+
+
+
+/* add what is decoded so far to a decoder that takes it right away, and */
+/* report the event. Returns false if there is not enough memory        */
+bool reportEvent(TAPE *tape, SEGMENT *segment, int type, int64_t index)
+{
+  DECODER      *decoder = segment->decoder;
+  DECODER_EVENT event;
+
+  if (decoder==NULL) return true;
+
+  if (!flushSegment(decoder,segment)) return false;
+  if (decoder->callback==NULL) return true;
+
+  event.type=type;
+  event.time=(double)index/tape->frequency;
+  event.block=segment->count-1;
+  event.bytes=segment->length-segment->blocks[segment->count-1];
+  event.failed=segment->failed;
+  event.latency=tapeLatency(tape,index);
+
+  decoder->callback(&event,decoder->context);
+
+  return true;
+}
+
+
+
+/* count the last block of a segment as read completely */
+void completeBlock(SEGMENT *segment)
+{
+  segment->valid++;
+  segment->complete+=segment->length-segment->blocks[segment->count-1];
+  segment->places[segment->count-1].complete=true;
+}
+
+
+
+/* remember data that could not be read, less than a byte of it is */
+/* what trails a block. Returns false if there is not enough memory   */
+bool addSpan(SEGMENT *segment, SPAN *span)
+{
+  if (span->end-span->start<22*span->average) return true;
+
+  if (!growBuffer(&segment->spans,&segment->spansize,segment->spancount+1,
+		  sizeof(SPAN))) return false;
+  segment->spans[segment->spancount++]=*span;
+
+  return true;
+}
+
+
+
+/* read bytes of a span from a sample on, with the tape of a rung, up */
+/* to limit bytes. Returns the number of bytes (-1 if there is not    */
+/* enough memory), from is set to where reading stopped                */
+int64_t readSpan(TAPE *tape, SPAN *span, int64_t *from, int64_t limit,
+		 uint8_t **bytes, int64_t *size)
+{
+  PULSE   *p;
+  int64_t  lead,pulse,start,measured,count = 0;
+  int      data,i;
+
+  /* start a little early, so the filters are settled at the byte and */
+  /* the pulses are measured from the one that is nearest to it. A     */
+  /* tape that still has its pulses from there on (the starts that are */
+  /* tried are close together) reads on, so samples are prepared once. */
+  /* The window starts at a multiple of 64 like the cuts of the tape,   */
+  /* as the bitmap of loud samples has a bit for each of them           */
+  lead= *from>RECOVER_LEAD ? (*from-RECOVER_LEAD)&~(int64_t)63 : 0;
+  if (tape->pulsecount==tape->pulsebase ||
+      lead<tape->base || lead>tape->ready ||
+      tapePulse(tape,tape->pulsebase)->offset>*from) {
+    tapeSeek(tape,lead,tape->size);
+    pulse=findPulse(tape,lead,0);
+  }
+  else pulse=tape->pulsecount-1;
+  measured=tape->pulsecount;
+
+  pulse=findPulse(tape,*from,pulse);
+  p=tapePulse(tape,pulse);
+  if (p->offset<*from && *from-p->offset>p->offset+p->width-*from) pulse++;
+
+  /* up to the end of the span, or the byte that fails again */
+  for (;;) {
+
+    start=pulseOffset(tape,pulse);
+    if (start>=span->end || count>=limit) break;
+
+    data= tape->engine==DECODER_TONES ? readByteTone(tape,&pulse,span->average) :
+					readByte(tape,&pulse,span->average);
+    if (data<0) break;
+
+    /* the stop bits are not looked at while decoding, here they are, */
+    /* so a start that is off by some bits does not read on           */
+    for (i=1;i<=4;i++)
+      if (tapePulse(tape,pulse-i)->width>=span->average*tape->window) break;
+    if (i<=4) break;
+
+    if (!growBuffer(bytes,size,count+1,sizeof(uint8_t))) return -1;
+    (*bytes)[count++]=data;
+  }
+
+  *from=start;
+  if (tape->stats) tape->stats->pulses+=tape->pulsecount-measured;
+
+  return count;
+}
+
+
+
+/* put bytes in the data of a segment, the blocks after it move along. */
+/* Returns false if there is not enough memory                         */
+bool spliceBytes(SEGMENT *segment, int64_t block, int64_t offset,
+		 const uint8_t *bytes, int64_t count)
+{
+  int64_t i;
+
+  if (!growBuffer(&segment->data,&segment->size,segment->length+count,
+		  sizeof(uint8_t))) return false;
+  memmove(segment->data+offset+count,segment->data+offset,
+	  segment->length-offset);
+  memcpy(segment->data+offset,bytes,count);
+  segment->length+=count;
+
+  for (i=block+1;i<segment->count;i++) segment->blocks[i]+=count;
+
+  return true;
+}
+
+
+
+/* try every rung of the ladder from a sample, the bytes of the one */
+/* that gets furthest are kept in best and reached is set to where   */
+/* it stopped. Returns -1 if there is not enough memory               */
+int64_t climbLadder(SPAN *span, int64_t from, int64_t limit,
+		    int64_t *reached, RECOVERY *recovery)
+{
+  uint8_t *swap;
+  int64_t  next,swapsize,length,count = 0;
+  int      r;
+
+  *reached=from;
+  for (r=0;r<ITEMS(ladder);r++) {
+
+    next=from;
+    length=readSpan(&recovery->tapes[r],span,&next,limit,&recovery->bytes,
+		    &recovery->size);
+    if (length<0) return -1;
+    if (length>count) {
+      swap=recovery->best; recovery->best=recovery->bytes;
+      recovery->bytes=swap;
+      swapsize=recovery->bestsize; recovery->bestsize=recovery->size;
+      recovery->size=swapsize;
+      count=length;
+      *reached=next;
+    }
+
+    /* the rest of the span is read, no need to try more */
+    if (count && *reached>=span->end) break;
+  }
+
+  return count;
+}
+
+
+
+/* open a tape with the settings of each rung of the ladder */
+bool openLadder(TAPE *tape, RECOVERY *recovery)
+{
+  TAPE model;
+
+  for (;recovery->opened<ITEMS(ladder);recovery->opened++) {
+
+    model=*tape;
+    model.threshold=ladder[recovery->opened].threshold;
+    model.envelope=ladder[recovery->opened].envelope;
+    model.window=ladder[recovery->opened].window;
+    model.engine=ladder[recovery->opened].engine;
+
+    if (tapeClone(&recovery->tapes[recovery->opened],&model)<0)
+      return false;
+  }
+
+  return true;
+}
+
+
+
+/* read the data that could not be read again, only where it failed.  */
+/* Each rung of the ladder is tried from where reading got stuck, the */
+/* one that gets furthest is kept and all are tried again from there. */
+/* Bytes are only kept when a run of them is read, or the rest of the */
+/* span. A byte that none of them can read ends the span, the block  */
+/* stays incomplete and how much could not be read is logged. Returns */
+/* false if there is not enough memory                                */
+bool recoverSpans(TAPE *tape, SEGMENT *segment)
+{
+  RECOVERY recovery;
+  SPAN    *span;
+  int64_t  from,reached,count,found,step,next,stop,lost;
+  int64_t  shift = 0;
+  int64_t  i;
+  int      r;
+  bool     ok;
+
+  memset(&recovery,0,sizeof(recovery));
+  ok=openLadder(tape,&recovery);
+
+  for (i=0;ok && i<segment->spancount;i++) {
+
+    span=&segment->spans[i];
+    span->offset+=shift;
+    from=span->start;
+    found=0;
+
+    while (from<span->end) {
+
+      count=climbLadder(span,from,INT64_MAX,&reached,&recovery);
+      if (count<0) ok=false;
+      if (count<RECOVER_RUN && reached<span->end) break;
+
+      if (!spliceBytes(segment,span->block,span->offset+found,recovery.best,
+		       count)) {
+	ok=false;
+	break;
+      }
+      found+=count;
+      from=reached;
+    }
+
+    if (ok && from<span->end) {
+
+      /* the first start further on that reads a run of bytes, looked */
+      /* for a pulse at a time up to a number of bytes, a byte is a   */
+      /* start bit, eight data bits and two stop bits, or 22 short    */
+      /* pulses long                                                  */
+      step= span->average>1 ? (int64_t)span->average : 1;
+      stop=from+(int64_t)(22*RECOVER_SKIPS*span->average);
+      if (stop>span->end) stop=span->end;
+
+      for (next=from+step;next<stop;next+=step) {
+	count=climbLadder(span,next,RECOVER_RUN,&reached,&recovery);
+	if (count<0) ok=false;
+	if (count<0 || count>=RECOVER_RUN || (count && reached>=span->end))
+	  break;
+      }
+
+      lost=(int64_t)((next-from)/(22*span->average)+0.5);
+      if (next<stop)
+	segmentLog(segment,"[%.1f] about %lld bytes of block %lld could not "
+		   "be read\n",(double)from/tape->frequency,
+		   (long long)(lost>1 ? lost : 1),(long long)span->block);
+      else
+	segmentLog(segment,"[%.1f] block %lld could not be read on\n",
+		   (double)from/tape->frequency,(long long)span->block);
+    }
+
+    if (found==0) continue;
+
+    segmentLog(segment,"[%.1f] recovered %lld bytes of block %lld%s\n",
+	       (double)span->start/tape->frequency,(long long)found,
+	       (long long)span->block,from<span->end ? ", not all of it" : "");
+
+    segment->places[span->block].recovered=true;
+    if (from>=span->end) segment->failed--;
+    if (tape->stats) tape->stats->recovered+=found;
+    shift+=found;
+  }
+
+  for (r=0;r<recovery.opened;r++) tapeClose(&recovery.tapes[r]);
+  free(recovery.bytes);
+  free(recovery.best);
+
+  return ok;
+}
+
+
+
+/* decode the data blocks of a segment, it is only done if there was */
+/* memory for all of it                                                */
+void decodeSegment(TAPE *tape, SEGMENT *segment)
+{
+  int64_t index,position,pulse,start,header;
+  int32_t frequency = tape->frequency;
+  float average;
+  int   data;
+  bool  ended = false;  /* a block was read, see what follows it */
+  bool  pending = false; /* and it ended in data that could not be read */
+  bool  carried,dropped;
+  bool  ok = true;
+  SPAN  span,previous;
+  STATS *stats = tape->stats;
+  STATS before;
+  TIMER timer;
+  int   s;
+
+  /* the stages that run while decoding are timed on their own */
+  if (stats) before=*stats;
+  startTimer(stats,&timer);
+
+  tapeSeek(tape,segment->start,segment->end);
+
+  /* sample probably starts with some silence before the data, skip it */
+  index=segment->start;
+  pulse=0;
+  skipSilence(tape,&index);
+
+  /* loop through all audio data and extract the contents */
+  for (;ok && index<tape->size;index++) {
+
+    /* detect silent parts and skip them */
+    if (isSilence(tape,index)) {
+
+      if (ended) completeBlock(segment);
+      ended=false;
+      pending=false;
+      if (stats) stats->silences++;
+
+      segmentLog(segment,"[%.1f] skipping silence\n",(double)index/frequency);
+      skipSilence(tape,&index);
+      if (index>=tape->size) break;
+    }
+
+    /* detect header and proces the data block followed */
+    pulse=findPulse(tape,index,pulse);
+    position=index;
+    if (findHeader(tape,&pulse,&position)) {
+
+      if (stats) stats->headers++;
+      if (ended) completeBlock(segment);
+
+      /* a header right where a block could not be read can be noise */
+      carried=pending;
+      dropped=false;
+      previous=span;
+      pending=false;
+
+      header=index;
+      segmentLog(segment,"[%.1f] header detected\n",(double)index/frequency);
+      average=skipHeader(tape,&pulse);
+      index=pulseOffset(tape,pulse);
+
+      /* a .cas header is written here when needed */
+      if (!growBuffer(&segment->blocks,&segment->allocated,segment->count+1,
+		      sizeof(int64_t)) ||
+	  !growBuffer(&segment->places,&segment->placesize,segment->count+1,
+		      sizeof(PLACE))) {
+	ok=false;
+	break;
+      }
+      segment->places[segment->count].start=header;
+      segment->places[segment->count].complete=false;
+      segment->places[segment->count].recovered=false;
+      segment->blocks[segment->count++]=segment->length;
+
+      segmentLog(segment,"[%.1f] data block\n",(double)index/frequency);
+      if (!reportEvent(tape,segment,DECODER_HEADER,index)) {
+	ok=false;
+	break;
+      }
+
+      while (!isSilence(tape,index) && index<tape->size) {
+	start=index;
+	data= tape->engine==DECODER_TONES ? readByteTone(tape,&pulse,average) :
+					    readByte(tape,&pulse,average);
+	index=pulseOffset(tape,pulse);
+	if (data<0) {
+	  if (stats) stats->failures++;
+
+	  /* every block ends like this, it is only known to be damaged */
+	  /* if data without a header follows                           */
+	  span.start=start;
+	  span.block=segment->count-1;
+	  span.offset=segment->length;
+	  span.average=average;
+	  pending=tape->recover;
+
+	  /* a header with other pulses than the block that failed just */
+	  /* before it is taken for noise in that block                 */
+	  if (carried && (average*tape->window<previous.average ||
+			  average>previous.average*tape->window)) {
+	    segment->length=segment->blocks[--segment->count];
+	    span=previous;
+	    dropped=true;
+
+	    /* the header made the block before it look complete */
+	    if (segment->places[segment->count-1].complete) {
+	      segment->valid--;
+	      segment->complete-=segment->length-
+				 segment->blocks[segment->count-1];
+	      segment->places[segment->count-1].complete=false;
+	    }
+	  }
+	  break;
+	}
+
+	if (!growBuffer(&segment->data,&segment->size,segment->length+1,
+			sizeof(uint8_t))) {
+	  ok=false;
+	  break;
+	}
+	segment->data[segment->length++]=data;
+      }
+
+      /* a block taken for noise leaves the one before it unfinished */
+      if (!dropped) segment->places[segment->count-1].end=index;
+      ended= !dropped && segment->length>segment->blocks[segment->count-1];
+      if (ok && !reportEvent(tape,segment,DECODER_BLOCK,index)) ok=false;
+
+    } else {
+
+      /* data found without a header, skip it */
+      segmentLog(segment,"[%.1f] skipping headerless data\n",
+		 (double)index/frequency);
+      segment->failed++;
+      ended=false;
+      index=position;
+
+      if (pending) {
+	span.end=position;
+	ok=addSpan(segment,&span);
+      }
+      pending=false;
+    }
+
+  }
+
+  if (ok && ended) completeBlock(segment);
+
+  /* the damaged parts only, with other settings */
+  if (ok && segment->spancount) ok=recoverSpans(tape,segment);
+  segment->done=ok;
+
+  if (stats) {
+    stopTimer(stats,&timer,STAGE_DECODE);
+    for (s=0;s<STAGES;s++)
+      if (s!=STAGE_DECODE) {
+	stats->wall[STAGE_DECODE]-=stats->wall[s]-before.wall[s];
+	stats->cpu[STAGE_DECODE]-=stats->cpu[s]-before.cpu[s];
+      }
+
+    stats->pulses+=tape->pulsecount;
+    stats->bytes+=segment->length;
+    stats->skipped+=segment->failed;
+  }
+}
+
+
+
+/* free what is decoded of a segment */
+void freeSegment(SEGMENT *segment)
+{
+  free(segment->data);
+  free(segment->blocks);
+  free(segment->places);
+  free(segment->log);
+  free(segment->spans);
+}
+
+
+
+/* add the decoded data of a segment, in order of the segments. Returns */
+/* false if there is not enough memory                                  */
+bool writeSegment(DECODER *decoder, SEGMENT *segment)
+{
+  bool written;
+
+  if (segment->logged && decoder->messages)
+    fwrite(segment->log,1,segment->logged,decoder->messages);
+
+  written=flushSegment(decoder,segment);
+  freeSegment(segment);
+
+  return written;
+}
+
+
+
+/* add the stats of a thread to those of the tape */
+void addWork(WORK *work, STATS *stats)
+{
+  if (work->tape->stats==NULL) return;
+
+  pthread_mutex_lock(&work->lock);
+  addStats(work->tape->stats,stats);
+  pthread_mutex_unlock(&work->lock);
+}
+
+
+
+/* decoding thread, takes segments until all are taken */
+void *decodeSegments(void *arg)
+{
+  WORK   *work = (WORK*)arg;
+  TAPE    tape;
+  STATS   stats;
+  int32_t i;
+
+  if (tapeClone(&tape,work->tape)<0) return NULL;
+
+  /* each thread keeps its own stats, they are added up at the end */
+  memset(&stats,0,sizeof(stats));
+  if (tape.stats) tape.stats=&stats;
+
+  for (;;) {
+
+    pthread_mutex_lock(&work->lock);
+    i=work->next++;
+    pthread_mutex_unlock(&work->lock);
+
+    if (i>=work->count) break;
+    decodeSegment(&tape,&work->segments[i]);
+  }
+
+  addWork(work,&stats);
+
+  tapeClose(&tape);
+  return NULL;
+}
+
+
+
+/* sweeping thread, takes runs until all are taken, the runs of a */
+/* stereo recording decode a source each                          */
+void *sweepRuns(void *arg)
+{
+  WORK   *work = (WORK*)arg;
+  TAPE    model,tape;
+  RUN    *run;
+  STATS   stats;
+  int32_t i;
+
+  memset(&stats,0,sizeof(stats));
+
+  for (;;) {
+
+    pthread_mutex_lock(&work->lock);
+    i=work->next++;
+    pthread_mutex_unlock(&work->lock);
+
+    if (i>=work->count) break;
+    run=&work->runs[i];
+
+    /* a window with the settings of the run, on the same sample data */
+    model=*work->tape;
+    model.threshold=run->threshold;
+    model.envelope=run->envelope;
+    model.window=run->window;
+    model.phase=run->phase;
+    model.scale= run->normalize ? work->scale : 0;
+    model.source=run->source;
+    model.recover=run->recover;
+    if (model.stats) model.stats=&stats;
+
+    if (tapeClone(&tape,&model)<0) continue;
+
+    /* each source has a peak level of its own */
+    if (run->normalize && !work->scale) tape.scale=tapeScale(&tape);
+
+    run->segment.end=tape.size;
+    run->segment.buffered=true;
+    decodeSegment(&tape,&run->segment);
+
+    tapeClose(&tape);
+  }
+
+  addWork(work,&stats);
+
+  return NULL;
+}
+
+
+
+/* start a number of threads on the work and wait for them to finish */
+void runWorkers(void *(*worker)(void*), WORK *work, int count)
+{
+  pthread_t *workers;
+  int i;
+
+  work->next=0;
+  pthread_mutex_init(&work->lock,NULL);
+
+  workers=(pthread_t*)malloc(count*sizeof(pthread_t));
+  if (workers==NULL) count=0;
+
+  for (i=0;i<count;i++)
+    if (pthread_create(&workers[i],NULL,worker,work)) break;
+
+  /* work on this thread if no thread could be started */
+  if (i==0) worker(work);
+  while (i--) pthread_join(workers[i],NULL);
+
+  pthread_mutex_destroy(&work->lock);
+  free(workers);
+}
+
+
+
+/* order runs on the data in complete blocks, then on the fewest read  */
+/* errors, the most complete blocks and the most data. Noise can look  */
+/* like many tiny blocks, so the number of blocks is not the first    */
+/* thing to look at. The first run wins a tie                          */
+int compareRuns(const void *a, const void *b)
+{
+  const RUN *x = *(const RUN**)a;
+  const RUN *y = *(const RUN**)b;
+
+  if (x->segment.complete!=y->segment.complete)
+    return x->segment.complete>y->segment.complete ? -1 : 1;
+  if (x->segment.failed!=y->segment.failed)
+    return x->segment.failed<y->segment.failed ? -1 : 1;
+  if (x->segment.valid!=y->segment.valid)
+    return x->segment.valid>y->segment.valid ? -1 : 1;
+  if (x->segment.length!=y->segment.length)
+    return x->segment.length>y->segment.length ? -1 : 1;
+
+  return (x>y)-(x<y);
+}
+
+
+
+/* decode the tape with every combination of settings, show how well */
+/* each one did and return the best result as the only segment, or   */
+/* NULL if there is not enough memory                                */
+SEGMENT *sweepTape(TAPE *tape, int threads, FILE *messages)
+{
+  WORK     work;
+  RUN     *runs,**ranking;
+  SEGMENT *best;
+  int32_t  count,i;
+  int      t,e,w,p,n;
+  char     options[64];
+  TIMER    timer;
+
+  count=ITEMS(sweepThresholds)*ITEMS(sweepEnvelopes)*ITEMS(sweepWindows)*2*2;
+
+  runs=(RUN*)calloc(count,sizeof(RUN));
+  ranking=(RUN**)malloc(count*sizeof(RUN*));
+  best=(SEGMENT*)malloc(sizeof(SEGMENT));
+  if (runs==NULL || ranking==NULL || best==NULL) {
+    free(runs);
+    free(ranking);
+    free(best);
+    return NULL;
+  }
+
+  i=0;
+  for (n=0;n<2;n++)
+    for (p=0;p<2;p++)
+      for (t=0;t<ITEMS(sweepThresholds);t++)
+	for (e=0;e<ITEMS(sweepEnvelopes);e++)
+	  for (w=0;w<ITEMS(sweepWindows);w++,i++) {
+	    runs[i].threshold=sweepThresholds[t];
+	    runs[i].envelope=sweepEnvelopes[e];
+	    runs[i].window=sweepWindows[w];
+	    runs[i].phase= p==0;
+	    runs[i].normalize= n==1;
+	  }
+
+  /* the peak level is the same for all runs, find it once */
+  work.tape=tape;
+  startTimer(tape->stats,&timer);
+  work.scale=tapeScale(tape);
+  stopTimer(tape->stats,&timer,STAGE_NORMALIZE);
+  work.runs=runs;
+  work.count=count;
+  runWorkers(sweepRuns,&work,threads>0 ? threads : cpuCount());
+
+  for (i=0;i<count;i++) ranking[i]=&runs[i];
+  qsort(ranking,count,sizeof(RUN*),compareRuns);
+
+  logMessage(messages,
+	     "rank  settings                 blocks  complete  errors     bytes\n");
+  for (i=0;i<count;i++) {
+
+    snprintf(options,sizeof(options),"-t %d -e %d -w %.1f%s%s",
+	     ranking[i]->threshold,ranking[i]->envelope,ranking[i]->window,
+	     ranking[i]->normalize ? " -n" : "",
+	     ranking[i]->phase ? "" : " -p");
+
+    if (!ranking[i]->segment.done)
+      logMessage(messages,"%4d  %-23s  failed\n",i+1,options);
+    else
+      logMessage(messages,"%4d  %-23s %7d %9d %7d %9d\n",i+1,options,
+		 (int)ranking[i]->segment.count,(int)ranking[i]->segment.valid,
+		 (int)ranking[i]->segment.failed,(int)ranking[i]->segment.length);
+  }
+
+  /* keep the best result, without the log of the run */
+  *best=ranking[0]->segment;
+  free(best->log);
+  best->log=NULL;
+  best->logged=0;
+
+  for (i=1;i<count;i++) freeSegment(&ranking[i]->segment);
+
+  free(runs);
+  free(ranking);
+
+  return best;
+}
+
+
+
+/* order blocks on the sample where they start */
+int comparePicks(const void *a, const void *b)
+{
+  const PICK *x = (const PICK*)a;
+  const PICK *y = (const PICK*)b;
+  int64_t from = x->segment->places[x->block].start;
+  int64_t to   = y->segment->places[y->block].start;
+
+  return (from>to)-(from<to);
+}
+
+
+
+/* bytes in a block of a segment */
+int64_t blockLength(SEGMENT *segment, int64_t block)
+{
+  return (block+1<segment->count ? segment->blocks[block+1] : segment->length)-
+	 segment->blocks[block];
+}
+
+
+
+/* see if two blocks have samples in common */
+bool overlaps(const PLACE *a, const PLACE *b)
+{
+  return a->start<b->end && b->start<a->end;
+}
+
+
+
+/* find the first block of a segment from block on that has samples in */
+/* common with a block of another segment. Returns -1 if there is none */
+int64_t findOverlap(SEGMENT *segment, PLACE *place, int64_t block)
+{
+  for (;block<segment->count;block++)
+    if (overlaps(&segment->places[block],place)) return block;
+
+  return -1;
+}
+
+
+
+/* put the blocks of the best run together with blocks of other runs. */
+/* A block of the best run that was not read to its end is replaced   */
+/* by the same block of another run that was, blocks that only other  */
+/* runs read to their end are added where they are on the tape.       */
+/* Returns NULL if there is not enough memory                          */
+SEGMENT *mergeRuns(RUN **ranking, int32_t count, TAPE *tape, FILE *messages)
+{
+  SEGMENT *base = &ranking[0]->segment, *merged, *segment;
+  PICK    *picks;
+  PLACE   *place;
+  int64_t  total,picked,replaced,from,next,i,j,k,length;
+  int32_t  r;
+  bool     whole;
+
+  total=0;
+  for (r=0;r<count;r++) total+=ranking[r]->segment.count;
+
+  merged=(SEGMENT*)calloc(1,sizeof(SEGMENT));
+  picks=(PICK*)malloc((total+1)*sizeof(PICK));
+  if (merged==NULL || picks==NULL) {
+    free(merged);
+    free(picks);
+    return NULL;
+  }
+
+  /* the blocks of the best run. Blocks of it that were not all read */
+  /* to their end (noise can look like a header, that ends a block   */
+  /* too) or that were read again are replaced by a block of another */
+  /* run that was read in one go, when it has at least as much data  */
+  picked=replaced=0;
+  for (i=0;i<base->count;i=next) {
+
+    picks[picked].segment=base;
+    picks[picked].block=i;
+    next=i+1;
+    place=&base->places[i];
+    from= i>0 ? base->places[i-1].end : 0;
+
+    for (r=1;r<count && picks[picked].segment==base;r++) {
+
+      segment=&ranking[r]->segment;
+      for (j=findOverlap(segment,place,0);j>=0;j=findOverlap(segment,place,j+1)) {
+
+	if (!segment->places[j].complete || segment->places[j].recovered ||
+	    segment->places[j].start<from)
+	  continue;
+
+	/* the blocks it covers */
+	length=0;
+	whole=true;
+	for (k=i;k<base->count &&
+		 overlaps(&base->places[k],&segment->places[j]);k++) {
+	  whole=whole && base->places[k].complete &&
+		!base->places[k].recovered;
+	  length+=blockLength(base,k);
+	}
+	if (whole || blockLength(segment,j)<length) continue;
+
+	picks[picked].segment=segment;
+	picks[picked].block=j;
+	next=k;
+	replaced++;
+	logMessage(messages,"[%.1f] block %lld read from the %s\n",
+		   (double)place->start/tape->frequency,(long long)i,
+		   sourceNames[ranking[r]->source]);
+	break;
+      }
+    }
+
+    picked++;
+  }
+
+  /* blocks only other runs found, the first run to find one has it */
+  for (r=1;r<count;r++) {
+
+    segment=&ranking[r]->segment;
+    for (j=0;j<segment->count;j++) {
+
+      place=&segment->places[j];
+      if (!place->complete || findOverlap(base,place,0)>=0) continue;
+
+      for (k=base->count;k<picked;k++)
+	if (overlaps(&picks[k].segment->places[picks[k].block],place)) break;
+      if (k<picked) continue;
+
+      picks[picked].segment=segment;
+      picks[picked].block=j;
+      picked++;
+
+      logMessage(messages,"[%.1f] block only found in the %s\n",
+		 (double)place->start/tape->frequency,
+		 sourceNames[ranking[r]->source]);
+    }
+  }
+
+  qsort(picks,picked,sizeof(PICK),comparePicks);
+
+  /* copy the blocks in order */
+  for (k=0;k<picked;k++) {
+
+    segment=picks[k].segment;
+    i=picks[k].block;
+    length=blockLength(segment,i);
+
+    if (!growBuffer(&merged->blocks,&merged->allocated,merged->count+1,
+		    sizeof(int64_t)) ||
+	!growBuffer(&merged->places,&merged->placesize,merged->count+1,
+		    sizeof(PLACE)) ||
+	!growBuffer(&merged->data,&merged->size,merged->length+length,
+		    sizeof(uint8_t))) {
+      freeSegment(merged);
+      free(merged);
+      free(picks);
+      return NULL;
+    }
+
+    merged->places[merged->count]=segment->places[i];
+    merged->blocks[merged->count++]=merged->length;
+    memcpy(merged->data+merged->length,segment->data+segment->blocks[i],length);
+    merged->length+=length;
+
+    if (segment->places[i].complete) {
+      merged->valid++;
+      merged->complete+=length;
+    }
+  }
+
+  /* the stretches that could not be read by the best run, less the */
+  /* blocks that were read by another one                           */
+  merged->failed= base->failed>replaced ? base->failed-replaced : 0;
+  merged->done=true;
+
+  free(picks);
+
+  return merged;
+}
+
+
+
+/* decode each source of a stereo recording on a thread of its own, */
+/* from the same sample data, and merge the results per block.       */
+/* Returns NULL if there is not enough memory                        */
+SEGMENT *decodeSources(TAPE *tape, const DECODER_SETTINGS *settings,
+		       int count, FILE *messages)
+{
+  WORK     work;
+  RUN     *runs,**ranking;
+  SEGMENT *merged;
+  int32_t  total = count, i;
+
+  runs=(RUN*)calloc(count,sizeof(RUN));
+  ranking=(RUN**)malloc(count*sizeof(RUN*));
+  if (runs==NULL || ranking==NULL) {
+    free(runs);
+    free(ranking);
+    return NULL;
+  }
+
+  for (i=0;i<count;i++) {
+    runs[i].threshold=settings->threshold;
+    runs[i].envelope=settings->envelope;
+    runs[i].window=settings->window;
+    runs[i].phase=settings->phase;
+    runs[i].normalize=settings->normalize;
+    runs[i].source=i;
+    runs[i].recover=settings->recover;
+  }
+
+  work.tape=tape;
+  work.scale=0;
+  work.runs=runs;
+  work.count=count;
+  runWorkers(sweepRuns,&work,settings->threads>0 ? settings->threads : count);
+
+  for (i=0;i<count;i++) ranking[i]=&runs[i];
+  qsort(ranking,count,sizeof(RUN*),compareRuns);
+
+  logMessage(messages,
+	     "rank  source            blocks  complete  errors     bytes\n");
+  for (i=0;i<count;i++) {
+
+    if (!ranking[i]->segment.done)
+      logMessage(messages,"%4d  %-16s  failed\n",i+1,
+		 sourceNames[ranking[i]->source]);
+    else
+      logMessage(messages,"%4d  %-16s %7d %9d %7d %9d\n",i+1,
+		 sourceNames[ranking[i]->source],
+		 (int)ranking[i]->segment.count,(int)ranking[i]->segment.valid,
+		 (int)ranking[i]->segment.failed,(int)ranking[i]->segment.length);
+  }
+
+  /* runs that failed have nothing to add */
+  while (count>1 && !ranking[count-1]->segment.done) count--;
+
+  merged= ranking[0]->segment.done ? mergeRuns(ranking,count,tape,messages) :
+				      NULL;
+
+  for (i=0;i<total;i++) freeSegment(&runs[i].segment);
+
+  free(runs);
+  free(ranking);
+
+  return merged;
+}
+
+
+
+/* set up a decoder on an opened tape, shows what is decoded */
+DECODER *startDecoder(DECODER *decoder, const char *name)
+{
+  TAPE *tape = &decoder->tape;
+
+  if (decoder->frequency<0) {
+    free(decoder->name);
+    free(decoder);
+    return NULL;
+  }
+
+  if (tape->guessed)
+    logMessage(decoder->messages,
+	       "No format chunk found, assuming 8-bit mono at 43200 Hz\n");
+
+  /* Show wav info */
+  logMessage(decoder->messages,"Reading %s (%d Hz, %d-bits, %s)...\n",
+	     name,
+	     decoder->frequency,
+	     tape->bits,
+	     tape->channels==1 ? "mono" : "stereo" );
+
+  if (tape->factor>1)
+    logMessage(decoder->messages,"Decimating to %d Hz...\n",tape->frequency);
+
+  return decoder;
+}
+
+
+
+/* allocate a decoder, returns NULL if the settings are invalid */
+DECODER *newDecoder(const DECODER_SETTINGS *settings,
+		    FILE *messages, FILE *errors)
+{
+  DECODER *decoder;
+
+  if (settings->envelope<0 || settings->envelope>DECODER_MAX_ENVELOPE ||
+      settings->threads<0 || settings->rate<0 ||
+      (settings->sources!=1 && settings->sources!=2 && settings->sources!=4) ||
+      (settings->sources>1 && settings->sweep)) {
+    logMessage(errors,"Invalid decoder settings!\n");
+    return NULL;
+  }
+
+  if ((decoder=(DECODER*)calloc(1,sizeof(DECODER)))==NULL) {
+    logMessage(errors,"Not enough memory!\n");
+    return NULL;
+  }
+
+  decoder->settings=*settings;
+  decoder->messages=messages;
+  decoder->errors=errors;
+
+  pthread_once(&kernelsPicked,selectKernels);
+
+  return decoder;
+}
+
+
+
+/* open a wav file */
+DECODER *decoderOpen(const char *name, const DECODER_SETTINGS *settings,
+		     FILE *messages, FILE *errors)
+{
+  DECODER *decoder = newDecoder(settings,messages,errors);
+
+  if (decoder==NULL) return NULL;
+
+  /* the name is needed to open more windows on the file */
+  if ((decoder->name=(char*)malloc(strlen(name)+1))==NULL) {
+    logMessage(errors,"Not enough memory!\n");
+    free(decoder);
+    return NULL;
+  }
+  strcpy(decoder->name,name);
+
+  decoder->frequency=tapeOpen(decoder->name,&decoder->tape,settings,errors);
+
+  return startDecoder(decoder,name);
+}
+
+
+
+/* open a wav file in memory, it is used in place */
+DECODER *decoderOpenMemory(const uint8_t *wav, int64_t length,
+			   const DECODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors)
+{
+  DECODER *decoder = newDecoder(settings,messages,errors);
+
+  if (decoder==NULL) return NULL;
+
+  decoder->frequency=tapeOpenMemory(wav,length,&decoder->tape,settings,errors);
+
+  return startDecoder(decoder,"wav data");
+}
+
+
+
+/* decode the whole recording */
+int decoderRun(DECODER *decoder)
+{
+  DECODER_SETTINGS *settings = &decoder->settings;
+  TAPE     *tape = &decoder->tape;
+  WORK      work;
+  SEGMENT  *segments;
+  int32_t   count,i;
+  int       sources,status = 0;
+  TIMER     timer;
+
+  if (settings->stats) tape->stats=&decoder->stats;
+
+  /* a mono recording has one source only */
+  sources= tape->channels>1 ? settings->sources : 1;
+  if (settings->sources>1 && sources==1)
+    logMessage(decoder->messages,"Only one channel, decoding that one\n");
+
+  if (settings->normalize && !settings->sweep && sources==1) {
+    startTimer(tape->stats,&timer);
+    tape->scale=tapeScale(tape);
+    stopTimer(tape->stats,&timer,STAGE_NORMALIZE);
+  }
+
+  /* let's do it */
+  logMessage(decoder->messages,"Decoding audio data...\n");
+
+  if (settings->sweep) {
+
+    /* decode the whole tape with all settings, keep the best result */
+    segments=sweepTape(tape,settings->threads,decoder->messages);
+    count=1;
+
+  } else if (sources>1) {
+
+    /* decode the channels (and mixes) of the recording at the same */
+    /* time, keep the best of each block                            */
+    segments=decodeSources(tape,settings,sources,decoder->messages);
+    count=1;
+
+  } else if (settings->threads==0) {
+
+    /* decode the whole tape in one go, showing progress right away */
+    segments=(SEGMENT*)calloc(1,sizeof(SEGMENT));
+    if (segments==NULL) {
+      logMessage(decoder->errors,"Not enough memory!\n");
+      return -1;
+    }
+    segments[0].end=tape->size;
+    segments[0].messages=decoder->messages;
+    /* recovered bytes are put in between, so the data is only added */
+    /* when all of it is there                                       */
+    segments[0].decoder= settings->recover ? NULL : decoder;
+    count=1;
+
+    decodeSegment(tape,&segments[0]);
+
+  } else {
+
+    /* the parts between long silences are independent, decode them */
+    /* in parallel and put them back together in order              */
+    startTimer(tape->stats,&timer);
+    segments=splitTape(tape,&count);
+    stopTimer(tape->stats,&timer,STAGE_INGEST);
+
+    if (segments!=NULL) {
+      work.tape=tape;
+      work.segments=segments;
+      work.count=count;
+      runWorkers(decodeSegments,&work,settings->threads);
+    }
+  }
+
+  if (segments==NULL) {
+    logMessage(decoder->errors,"Not enough memory!\n");
+    return -1;
+  }
+
+  /* a segment is only done if there was memory for all of it */
+  for (i=0;i<count;i++) {
+
+    if (!segments[i].done) status=-1;
+    if (status) freeSegment(&segments[i]);
+    else if (!writeSegment(decoder,&segments[i])) status=-1;
+  }
+
+  free(segments);
+
+  if (status) logMessage(decoder->errors,"Not enough memory!\n");
+
+  return status;
+}
+
+
+
+/* open a stream that is read once, as the recording comes in */
+DECODER *decoderOpenStream(FILE *stream, int frequency, int bits, int channels,
+			   const DECODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors)
+{
+  DECODER *decoder;
+
+  /* the samples are only there once, and only in order */
+  if (settings->normalize || settings->sweep || settings->threads ||
+      settings->recover || settings->sources>1) {
+    logMessage(errors,"Invalid decoder settings for a stream!\n");
+    return NULL;
+  }
+
+  if (frequency>0 && (bits<8 || bits>32 || bits%8 || channels<1)) {
+    logMessage(errors,"Unsupported wav format!\n");
+    return NULL;
+  }
+
+  if ((decoder=newDecoder(settings,messages,errors))==NULL) return NULL;
+
+  decoder->frequency=tapeOpenStream(stream,&decoder->tape,settings,
+				    frequency,bits,channels,errors);
+
+  return startDecoder(decoder,"stream");
+}
+
+
+
+/* report events while decoding */
+void decoderEvents(DECODER *decoder, DECODER_CALLBACK callback, void *context)
+{
+  decoder->callback=callback;
+  decoder->context=context;
+}
+
+
+
+/* pull the decoded .cas data */
+int64_t decoderRead(DECODER *decoder, uint8_t *buffer, int64_t size)
+{
+  if (size>decoder->length-decoder->position)
+    size=decoder->length-decoder->position;
+
+  if (size<=0) return 0;
+
+  memcpy(buffer,decoder->output+decoder->position,size);
+  decoder->position+=size;
+
+  return size;
+}
+
+
+
+/* get all decoded .cas data, without copying it */
+const uint8_t *decoderData(DECODER *decoder, int64_t *size)
+{
+  *size=decoder->length;
+  return decoder->output;
+}
+
+
+
+/* counters and times so far */
+STATS *decoderStats(DECODER *decoder)
+{
+  return decoder->settings.stats ? &decoder->stats : NULL;
+}
+
+
+
+/* release the decoder */
+void decoderClose(DECODER *decoder)
+{
+  if (decoder==NULL) return;
+
+  tapeClose(&decoder->tape);
+  free(decoder->output);
+  free(decoder->name);
+  free(decoder);
+}
@@ -0,0 +1,862 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         encoder.c                                                */
+/* version:      1.31 (April 11, 2016)                                    */
+/*                                                                        */
+/* description:  Encoder of the castools library, turns the contents of a */
+/*               .cas file into .wav samples that can be copied onto a    */
+/*               tape to be read by a real MSX.                           */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/*                                                                        */
+/* Copyright 2001-2016 Vincent van Dam (vincentd@erg.verweg.com)          */
+/* MultiCPU Copyright 2007 Ramones     (ramones@kurarizeku.net)           */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+#include <math.h>
+
+#include "castools.h"
+
+/* number of ouput samples for silent parts */
+#define SHORT_SILENCE     1000                /* 1 second  */
+#define LONG_SILENCE      2000                /* 2 seconds */
+#define MAX_SILENCE       60000
+
+/* length of pulses, in halves of a bit */
+#define LONG_PULSE        2
+#define SHORT_PULSE       1
+
+/* a byte is a start bit, eight data bits and two stop bits */
+#define BYTE_UNITS        22
+
+/* number of uint16_t pulses for headers at 1200 baud, other baudrates */
+/* keep the same time                                                  */
+#define LONG_HEADER       16000
+#define SHORT_HEADER      4000
+
+/* the bios looks for 1111 header pulses before it measures them */
+#define MIN_HEADER        1111
+#define MAX_HEADER        1000000
+
+/* baudrates a tape can be made at */
+#define MIN_BAUDRATE      600
+#define MAX_BAUDRATE      4800
+
+/* highest output sample rate */
+#define MAX_FREQUENCY     384000
+
+/* bytes needed to recognize a header and the file type after it */
+#define LOOKAHEAD         18
+
+/* tape profiles: baudrate, header pulses and milliseconds of silence */
+typedef struct
+{
+  const char *name;
+  int  baudrate;
+  int  longHeader;
+  int  shortHeader;
+  int  longSilence;
+  int  shortSilence;
+} PROFILE;
+
+const PROFILE profiles[] = {
+  { "standard", 1200, 16000, 4000, 2000, 1000 },  /* as the bios saves */
+  { "fast",     2400, 32000, 8000, 2000, 1000 },  /* the same as -2 */
+  { "short",    2400,  8000, 2000, 1000,  500 },
+  { "turbo",    3600,  6000, 1500, 1000,  500 },
+  { NULL }
+};
+
+/* prerendered pulses and bytes */
+typedef struct
+{
+  uint8_t  *data;
+  uint32_t  length;      /* bytes */
+  uint32_t  lag;         /* lag of the sample after it */
+} WAVEFORM;
+
+/* where the encoder is in the .cas data */
+enum step {
+  STEP_SCAN,             /* looking for a header */
+  STEP_SILENCE,          /* the silence before a block */
+  STEP_HEADER,           /* the header signal of a block */
+  STEP_DATA,             /* the bytes of a block */
+  STEP_DONE
+};
+
+/* the kind of file a block belongs to, it decides what follows it */
+enum kind {
+  KIND_ASCII,            /* blocks until an end of file mark */
+  KIND_BINARY,           /* a header block and one data block */
+  KIND_OTHER             /* a single block */
+};
+
+struct ENCODER
+{
+  ENCODER_SETTINGS settings;
+  FILE     *messages;
+  FILE     *errors;
+  CASDATA   cas;
+  CAS_BLOCK *blocks;     /* headers in the .cas data, if it is all there */
+  int64_t   count;
+  bool      owned;       /* the table is freed with the encoder */
+  bool      unindexed;   /* the table is still to be made */
+  int64_t   next;        /* first block not before the position */
+  int       units;       /* halves of a bit per second */
+  int       align;       /* bytes per sample */
+  bool      exact;       /* pulses are whole samples long */
+  uint32_t  lag;         /* where the next sample is after the start of */
+                         /* the next pulse, in 1/units of a sample      */
+  WAVEFORM *pulseWave[LONG_PULSE+1]; /* the pulses at every lag */
+  uint8_t  *pulseData;   /* the samples of all of them */
+  WAVEFORM  byteWave[256];  /* the bytes, if the pulses are exact */
+  uint8_t  *scratch;     /* bytes and header pulses rendered at a lag */
+  int       step;
+  int       kind;
+  int       block;       /* blocks of the file written so far */
+  bool      eof;         /* an end of file mark was in the block */
+  int64_t   silence;     /* samples of silence before the next block */
+  int64_t   pulses;      /* header pulses before the next block */
+  const uint8_t *wave;   /* waveform being read, NULL for silence */
+  uint32_t  length;      /* bytes in the waveform */
+  uint32_t  offset;      /* bytes of it read already */
+  int64_t   repeat;      /* times it is still to be read */
+  int64_t   samples;     /* bytes of samples read in total */
+  bool      dry;         /* only count the pulses, nothing is rendered */
+  int64_t   pulsed;      /* units of the pulses counted */
+  STATS     stats;       /* counters are kept always, times on request */
+};
+
+/* render a pulse of a number of units, starting lag after a sample. The */
+/* position in the signal is kept as a fraction of a sample (a phase     */
+/* accumulator), so pulses that are not a whole number of samples long   */
+/* do not drift, however long the tape is. The samples go to data, the */
+/* end of them is returned                                              */
+uint8_t *renderPulse(ENCODER *encoder, WAVEFORM *pulse, int units,
+		     uint32_t lag, uint8_t *data)
+{
+  int64_t  span = (int64_t)units*encoder->settings.rate;
+  uint32_t count,n;
+  double   length = (double)span/encoder->units;
+  double   scale  = 2.0*M_PI/length;
+  double   start  = (double)lag/encoder->units;
+  double   value;
+  int16_t  sample;
+
+  /* the samples that fall within the pulse */
+  count=(span-lag+encoder->units-1)/encoder->units;
+
+  pulse->data=data;
+  pulse->length=count*encoder->align;
+  pulse->lag=(uint32_t)(lag+(int64_t)count*encoder->units-span);
+
+  for (n=0;n<count;n++) {
+
+    value=sin(((double)n+start)*scale);
+
+    /* 16 bit samples are offset by half a step of their high byte, so   */
+    /* readers that only use the high byte round the signal instead of  */
+    /* flooring it and the pulses stay symmetric                         */
+    if (encoder->align==1) pulse->data[n] = (char)(value*127)^128;
+    else {
+      sample=(int16_t)(lrint(value*127*256)+128);
+      pulse->data[2*n]=sample&255;
+      pulse->data[2*n+1]=(sample>>8)&255;
+    }
+  }
+
+  return data+pulse->length;
+}
+
+
+
+/* the pulse of a number of units that comes next */
+WAVEFORM *nextPulse(ENCODER *encoder, int units)
+{
+  WAVEFORM *pulse = &encoder->pulseWave[units][encoder->lag];
+
+  encoder->lag=pulse->lag;
+
+  return pulse;
+}
+
+
+
+/* append a pulse to a rendered waveform */
+void appendPulse(uint8_t **data,WAVEFORM *pulse)
+{
+  memcpy(*data,pulse->data,pulse->length);
+  *data+=pulse->length;
+}
+
+
+
+/* render the pulses of a byte, returns the end of the data */
+uint8_t *renderByte(ENCODER *encoder, uint8_t *data, int byte)
+{
+  int  i;
+
+  /* one start bit */
+  appendPulse(&data,nextPulse(encoder,LONG_PULSE));
+
+  /* eight data bits */
+  for (i=0;i<8;i++) {
+    if (byte&1) {
+      appendPulse(&data,nextPulse(encoder,SHORT_PULSE));
+      appendPulse(&data,nextPulse(encoder,SHORT_PULSE));
+    } else appendPulse(&data,nextPulse(encoder,LONG_PULSE));
+    byte = byte >> 1;
+  }
+
+  /* two stop bits */
+  for (i=0;i<4;i++) appendPulse(&data,nextPulse(encoder,SHORT_PULSE));
+
+  return data;
+}
+
+
+
+/* set up the pulses for the output format, at every lag a pulse can */
+/* start at: the lag only ever moves by whole pulses, so it stays a   */
+/* multiple of the greatest common divisor of the rate and the units. */
+/* If pulses are a whole number of samples long all bytes are         */
+/* rendered once, otherwise each byte is rendered when it is needed   */
+/* at the lag it starts at. Returns false if there is not enough      */
+/* memory                                                              */
+bool renderWaveforms(ENCODER *encoder)
+{
+  uint8_t *data,*table;
+  int64_t  size,samples;
+  uint32_t lag,step,rest;
+  int  byte,i;
+
+  encoder->units=2*encoder->settings.baudrate;
+  encoder->align=encoder->settings.bits/8;
+  encoder->exact= encoder->settings.rate%encoder->units==0;
+
+  for (step=encoder->units,rest=encoder->settings.rate%step;rest;) {
+    lag=step%rest; step=rest; rest=lag;
+  }
+
+  /* the pulses are at most this long together, at all lags */
+  samples=0;
+  for (i=SHORT_PULSE;i<=LONG_PULSE;i++)
+    samples+=((int64_t)i*encoder->settings.rate/encoder->units+1)*
+	     (encoder->units/step);
+
+  /* a byte is at most this long, at any lag */
+  size=(BYTE_UNITS*(int64_t)encoder->settings.rate/encoder->units+BYTE_UNITS)*
+       encoder->align;
+
+  for (i=SHORT_PULSE;i<=LONG_PULSE;i++)
+    encoder->pulseWave[i]=(WAVEFORM*)calloc(encoder->units,sizeof(WAVEFORM));
+  encoder->pulseData=(uint8_t*)malloc(samples*encoder->align);
+  encoder->scratch=(uint8_t*)malloc(size);
+  table= encoder->exact ? (uint8_t*)malloc(256*size) : NULL;
+
+  if (encoder->pulseWave[SHORT_PULSE]==NULL ||
+      encoder->pulseWave[LONG_PULSE]==NULL || encoder->pulseData==NULL ||
+      encoder->scratch==NULL || (encoder->exact && table==NULL)) {
+    free(table);
+    return false;
+  }
+
+  for (data=encoder->pulseData,i=SHORT_PULSE;i<=LONG_PULSE;i++)
+    for (lag=0;lag<encoder->units;lag+=step)
+      data=renderPulse(encoder,&encoder->pulseWave[i][lag],i,lag,data);
+
+  if (!encoder->exact) return true;
+
+  for (data=table,byte=0;byte<256;byte++) {
+    encoder->byteWave[byte].data=data;
+    data=renderByte(encoder,data,byte);
+    encoder->byteWave[byte].length=data-encoder->byteWave[byte].data;
+  }
+
+  return true;
+}
+
+
+
+/* read a waveform a number of times next, NULL for silence */
+void setWave(ENCODER *encoder, const uint8_t *wave, uint32_t length,
+	     int64_t repeat)
+{
+  encoder->wave=wave;
+  encoder->length=length;
+  encoder->offset=0;
+  encoder->repeat=repeat;
+}
+
+
+
+/* all data is there, find the blocks once. Without a table the data is */
+/* scanned while it is encoded                                           */
+void findBlocks(ENCODER *encoder)
+{
+  if (!encoder->unindexed) return;
+
+  encoder->blocks=indexBlocks(encoder->cas.data,encoder->cas.size,
+			      &encoder->count);
+  encoder->owned=true;
+  encoder->unindexed=false;
+}
+
+
+
+/* check if a header starts at the current position, the block table */
+/* tells without looking at the data                                   */
+bool isHeader(ENCODER *encoder)
+{
+  CASDATA *cas = &encoder->cas;
+
+  findBlocks(encoder);
+
+  if (encoder->blocks==NULL)
+    return cas->size-cas->position>=8 &&
+	   !memcmp(cas->data+cas->position,HEADER,8);
+
+  while (encoder->next<encoder->count &&
+	 encoder->blocks[encoder->next].offset<cas->position)
+    encoder->next++;
+
+  return encoder->next<encoder->count &&
+	 encoder->blocks[encoder->next].offset==cas->position;
+}
+
+
+
+/* the samples of a silence of some milliseconds */
+void setSilence(ENCODER *encoder, int milliseconds)
+{
+  encoder->silence=(int64_t)encoder->settings.rate*milliseconds/1000;
+}
+
+
+
+/* the pulses of a header, by default as long as at 1200 baud */
+int64_t headerPulses(ENCODER *encoder, int pulses, int standard)
+{
+  if (pulses>0) return pulses;
+  return (int64_t)standard*encoder->settings.baudrate/1200;
+}
+
+
+
+/* start the blocks of a file, after the header at the current position */
+void startFile(ENCODER *encoder)
+{
+  CASDATA *cas = &encoder->cas;
+  int  type;
+  int  stime = encoder->settings.stime;
+  int  silence = encoder->settings.longSilence;
+
+  /* it probably works fine if a long header is used for every */
+  /* header but since the msx bios makes a distinction between */
+  /* them, we do also.                                         */
+
+  type= encoder->blocks ? encoder->blocks[encoder->next].type :
+	casType(cas->data+cas->position+8,cas->size-cas->position-8);
+  cas->position+=8;
+
+  if (silence<0) silence=LONG_SILENCE;
+  setSilence(encoder,stime>0 ? stime*1000 : silence);
+  encoder->kind=KIND_OTHER;
+
+  if (cas->size-cas->position<10)
+    logMessage(encoder->messages,"unknown file type: using long header\n");
+  else if (type==CAS_ASCII)
+    encoder->kind=KIND_ASCII;
+  else if (type==CAS_BINARY || type==CAS_BASIC)
+    encoder->kind=KIND_BINARY;
+  else {
+    logMessage(encoder->messages,"unknown file type: using long header\n");
+    setSilence(encoder,silence);
+  }
+
+  encoder->pulses=headerPulses(encoder,encoder->settings.longHeader,
+			       LONG_HEADER);
+  encoder->block=0;
+  encoder->eof=false;
+  encoder->step=STEP_SILENCE;
+}
+
+
+
+/* a block is written, see if another block of the file follows it */
+void endBlock(ENCODER *encoder, bool ended)
+{
+  encoder->block++;
+
+  /* ascii files go on until the end of file mark, binary files have */
+  /* one more block                                                  */
+  if ((encoder->kind==KIND_ASCII &&
+       (encoder->block==1 || (!encoder->eof && !ended))) ||
+      (encoder->kind==KIND_BINARY && encoder->block==1)) {
+
+    encoder->cas.position+=8;
+    setSilence(encoder,encoder->settings.shortSilence<0 ? SHORT_SILENCE :
+	       encoder->settings.shortSilence);
+    encoder->pulses=headerPulses(encoder,encoder->settings.shortHeader,
+				 SHORT_HEADER);
+    encoder->eof=false;
+    encoder->step=STEP_SILENCE;
+
+  } else encoder->step=STEP_SCAN;
+}
+
+
+
+/* set up the next waveform to read, returns false if more .cas data is */
+/* needed or all of it is written                                        */
+bool nextWave(ENCODER *encoder)
+{
+  CASDATA *cas = &encoder->cas;
+  const uint8_t *data;
+  WAVEFORM *pulse;
+  uint8_t  *end;
+  int       i;
+
+  for (;;) {
+
+    switch (encoder->step) {
+
+    /* search for a header in the .cas data */
+    case STEP_SCAN:
+      if (!haveData(cas,LOOKAHEAD)) return false;
+      if (cas->size-cas->position<8) { encoder->step=STEP_DONE; break; }
+
+      if (isHeader(encoder)) startFile(encoder);
+      else {
+
+	/* should not occur */
+	logMessage(encoder->errors,"skipping unhandled data\n");
+	cas->position++;
+      }
+      break;
+
+    case STEP_SILENCE:
+      encoder->stats.silences++;
+      setWave(encoder,NULL,1,encoder->silence*encoder->align);
+      encoder->step=STEP_HEADER;
+      return true;
+
+    /* the header pulses, all at once if each one is the same */
+    case STEP_HEADER:
+      if (encoder->pulses==0) {
+	encoder->stats.headers++;
+	encoder->step=STEP_DATA;
+	break;
+      }
+
+      if (encoder->dry) {
+	encoder->pulsed+=encoder->pulses*SHORT_PULSE;
+	encoder->pulses=0;
+	setWave(encoder,encoder->scratch,0,0);
+	return true;
+      }
+
+      pulse=nextPulse(encoder,SHORT_PULSE);
+      if (encoder->exact) {
+	setWave(encoder,pulse->data,pulse->length,encoder->pulses);
+	encoder->pulses=0;
+	return true;
+      }
+
+      end=encoder->scratch;
+      appendPulse(&end,pulse);
+      for (i=1;i<BYTE_UNITS && i<encoder->pulses;i++)
+	appendPulse(&end,nextPulse(encoder,SHORT_PULSE));
+      encoder->pulses-=i;
+
+      setWave(encoder,encoder->scratch,end-encoder->scratch,1);
+      return true;
+
+    /* write data until a header is detected */
+    case STEP_DATA:
+      if (!haveData(cas,8)) return false;
+
+      data=cas->data+cas->position;
+      if (isHeader(encoder)) {
+	endBlock(encoder,false);
+	break;
+      }
+
+      if (cas->position>=cas->size) {
+	cas->position=cas->size;
+	endBlock(encoder,true);
+	break;
+      }
+
+      if (data[0]==0x1a) encoder->eof=true;
+      cas->position++;
+      encoder->stats.bytes++;
+      if (encoder->dry) {
+	encoder->pulsed+=BYTE_UNITS;
+	setWave(encoder,encoder->scratch,0,0);
+      } else if (encoder->exact)
+	setWave(encoder,encoder->byteWave[data[0]].data,
+		encoder->byteWave[data[0]].length,1);
+      else {
+	end=renderByte(encoder,encoder->scratch,data[0]);
+	setWave(encoder,encoder->scratch,end-encoder->scratch,1);
+      }
+      return true;
+
+    default:
+      return false;
+    }
+  }
+}
+
+
+
+/* set the settings of a tape profile */
+int encoderProfile(const char *name, ENCODER_SETTINGS *settings)
+{
+  const PROFILE *profile;
+  PROFILE custom;
+  char    end;
+
+  for (profile=profiles;profile->name;profile++)
+    if (!strcmp(profile->name,name)) break;
+
+  if (profile->name==NULL) {
+
+    if (sscanf(name,"%d:%d:%d:%d:%d%c",&custom.baudrate,&custom.longHeader,
+	       &custom.shortHeader,&custom.longSilence,&custom.shortSilence,
+	       &end)!=5)
+      return -1;
+    profile=&custom;
+  }
+
+  settings->baudrate=profile->baudrate;
+  settings->longHeader=profile->longHeader;
+  settings->shortHeader=profile->shortHeader;
+  settings->longSilence=profile->longSilence;
+  settings->shortSilence=profile->shortSilence;
+
+  return 0;
+}
+
+
+
+/* the name of a tape profile */
+const char *encoderProfileName(int index)
+{
+  if (index<0 || index>=(int)(sizeof(profiles)/sizeof(PROFILE))) return NULL;
+  return profiles[index].name;
+}
+
+
+
+/* fill in the header pulses and silences that are left to the default, */
+/* as the encoder uses them                                              */
+void encoderFillDefaults(ENCODER_SETTINGS *settings)
+{
+  if (settings->longHeader<=0)
+    settings->longHeader=(int64_t)LONG_HEADER*settings->baudrate/1200;
+  if (settings->shortHeader<=0)
+    settings->shortHeader=(int64_t)SHORT_HEADER*settings->baudrate/1200;
+  if (settings->longSilence<0) settings->longSilence=LONG_SILENCE;
+  if (settings->shortSilence<0) settings->shortSilence=SHORT_SILENCE;
+}
+
+
+
+/* check the timing of a tape */
+bool encoderCheck(const ENCODER_SETTINGS *settings, FILE *errors)
+{
+  bool valid = true;
+
+  if (settings->baudrate<MIN_BAUDRATE || settings->baudrate>MAX_BAUDRATE) {
+    logMessage(errors,"baudrate should be %d to %d\n",MIN_BAUDRATE,
+	       MAX_BAUDRATE);
+    valid=false;
+  }
+
+  /* a short pulse needs two samples at least, which is only known */
+  /* for a baudrate that is valid                                   */
+  if (valid && (settings->rate<4*settings->baudrate ||
+		settings->rate>MAX_FREQUENCY)) {
+    logMessage(errors,"sample rate should be %d to %d for %d baud\n",
+	       4*settings->baudrate,MAX_FREQUENCY,settings->baudrate);
+    valid=false;
+  }
+
+  if (settings->bits!=8 && settings->bits!=16) {
+    logMessage(errors,"bits per sample should be 8 or 16\n");
+    valid=false;
+  }
+
+  /* 0 is the default of the baudrate */
+  if (settings->longHeader && (settings->longHeader<MIN_HEADER ||
+			       settings->longHeader>MAX_HEADER)) {
+    logMessage(errors,"the long header should be %d to %d pulses\n",
+	       MIN_HEADER,MAX_HEADER);
+    valid=false;
+  }
+
+  if (settings->shortHeader && (settings->shortHeader<MIN_HEADER ||
+				settings->shortHeader>MAX_HEADER)) {
+    logMessage(errors,"the short header should be %d to %d pulses\n",
+	       MIN_HEADER,MAX_HEADER);
+    valid=false;
+  }
+
+  /* -1 is the default */
+  if (settings->longSilence<-1 || settings->longSilence>MAX_SILENCE ||
+      settings->shortSilence<-1 || settings->shortSilence>MAX_SILENCE ||
+      settings->stime>MAX_SILENCE/1000) {
+    logMessage(errors,"silences should be 0 to %d seconds\n",
+	       MAX_SILENCE/1000);
+    valid=false;
+  }
+
+  return valid;
+}
+
+
+
+/* start an encoder with its waveforms rendered */
+ENCODER *newEncoder(const ENCODER_SETTINGS *settings,
+		    FILE *messages, FILE *errors)
+{
+  ENCODER *encoder;
+  TIMER    timer;
+
+  if (!encoderCheck(settings,errors)) {
+    logMessage(errors,"Invalid encoder settings!\n");
+    return NULL;
+  }
+
+  if ((encoder=(ENCODER*)calloc(1,sizeof(ENCODER)))==NULL) {
+    logMessage(errors,"Not enough memory!\n");
+    return NULL;
+  }
+
+  encoder->settings=*settings;
+  encoder->messages=messages;
+  encoder->errors=errors;
+  encoder->step=STEP_SCAN;
+
+  /* render the waveforms for the selected baudrate */
+  startTimer(encoderStats(encoder),&timer);
+  if (!renderWaveforms(encoder)) {
+    logMessage(errors,"Not enough memory!\n");
+    encoderClose(encoder);
+    return NULL;
+  }
+  stopTimer(encoderStats(encoder),&timer,STAGE_SYNTHESIS);
+
+  return encoder;
+}
+
+
+
+/* start an encoder */
+ENCODER *encoderOpen(const ENCODER_SETTINGS *settings,
+		     FILE *messages, FILE *errors)
+{
+  return newEncoder(settings,messages,errors);
+}
+
+
+
+/* start an encoder on .cas data in memory, used in place */
+ENCODER *encoderOpenMemory(const uint8_t *cas, int64_t size,
+			   const ENCODER_SETTINGS *settings,
+			   FILE *messages, FILE *errors)
+{
+  ENCODER *encoder = newEncoder(settings,messages,errors);
+
+  if (encoder) {
+    encoder->cas.data=(uint8_t*)cas;
+    encoder->cas.size=size;
+    encoder->cas.finished=true;
+    encoder->unindexed=true;
+  }
+
+  return encoder;
+}
+
+
+
+/* push .cas data */
+int encoderWrite(ENCODER *encoder, const uint8_t *data, int64_t size)
+{
+  return pushData(&encoder->cas,data,size);
+}
+
+
+
+/* there is no more .cas data */
+void encoderFinish(ENCODER *encoder)
+{
+  encoder->cas.finished=true;
+}
+
+
+
+/* pull .wav samples */
+int64_t encoderRead(ENCODER *encoder, uint8_t *buffer, int64_t size)
+{
+  int64_t  length = 0;
+  int64_t  n;
+  TIMER    timer;
+
+  startTimer(encoderStats(encoder),&timer);
+
+  while (length<size) {
+
+    if (encoder->repeat==0) {
+      if (!nextWave(encoder)) break;
+      continue;
+    }
+
+    if (encoder->wave==NULL) {
+
+      /* silence, 16 bit samples are signed */
+      n= size-length<encoder->repeat ? size-length : encoder->repeat;
+      memset(buffer+length,encoder->align==1 ? 128 : 0,n);
+      encoder->repeat-=n;
+
+    } else {
+
+      n=encoder->length-encoder->offset;
+      if (n>size-length) n=size-length;
+      memcpy(buffer+length,encoder->wave+encoder->offset,n);
+      encoder->offset+=n;
+
+      if (encoder->offset==encoder->length) {
+	encoder->offset=0;
+	encoder->repeat--;
+      }
+    }
+
+    length+=n;
+  }
+
+  encoder->samples+=length;
+  encoder->stats.samples=encoder->samples;
+  stopTimer(encoderStats(encoder),&timer,STAGE_SYNTHESIS);
+
+  return length;
+}
+
+
+
+/* the .wav header for a number of bytes of samples */
+void waveHeader(ENCODER *encoder, WAVE_HEADER *header, uint32_t size)
+{
+  uint32_t rate = encoder->settings.rate;
+  uint16_t align = encoder->align;
+  uint16_t bits = encoder->settings.bits;
+
+  memcpy(header->RiffID,"RIFF",4);
+  memcpy(header->WaveID,"WAVE",4);
+  memcpy(header->FmtID,"fmt ",4);
+  memcpy(header->DataID,"data",4);
+  header->FmtSize = BIGENDIANLONG(16);
+  header->wFormatTag = BIGENDIANSHORT(PCM_WAVE_FORMAT);
+  header->nChannels = BIGENDIANSHORT(MONO);
+  header->nSamplesPerSec = BIGENDIANLONG(rate);
+  header->nAvgBytesPerSec = BIGENDIANLONG(rate*align);
+  header->nBlockAlign = BIGENDIANSHORT(align);
+  header->wBitsPerSample = BIGENDIANSHORT(bits);
+  header->nDataBytes = BIGENDIANLONG(size);
+  header->RiffSize = BIGENDIANLONG(size);
+}
+
+
+
+/* the .wav header for the samples read so far */
+void encoderHeader(ENCODER *encoder, WAVE_HEADER *header)
+{
+  waveHeader(encoder,header,encoder->samples);
+}
+
+
+
+/* the size of all samples before any is read. The blocks are run through */
+/* without rendering them: silences are whole samples, and as the pulses  */
+/* keep their position to a fraction of a sample, they take as many       */
+/* samples together as their total length, however it is split up         */
+int64_t encoderSize(ENCODER *encoder, WAVE_HEADER *header)
+{
+  ENCODER dry;
+  int64_t size = 0;
+
+  /* pushed data is not known before it is all there */
+  if (!encoder->cas.finished || encoder->cas.allocated ||
+      encoder->step!=STEP_SCAN || encoder->cas.position) return -1;
+
+  findBlocks(encoder);
+
+  dry=*encoder;
+  dry.dry=true;
+  dry.messages=dry.errors=NULL;
+
+  while (nextWave(&dry))
+    if (dry.wave==NULL) size+=dry.repeat;
+
+  size+=(dry.pulsed*encoder->settings.rate+encoder->units-1)/encoder->units*
+	encoder->align;
+
+  if (header) waveHeader(encoder,header,size);
+  return size;
+}
+
+
+
+/* counters and times so far */
+STATS *encoderStats(ENCODER *encoder)
+{
+  return encoder->settings.stats ? &encoder->stats : NULL;
+}
+
+
+
+/* use the blocks from an index, before the encoder is read */
+void encoderBlocks(ENCODER *encoder, const CAS_BLOCK *blocks, int64_t count)
+{
+  if (encoder->owned) free(encoder->blocks);
+
+  encoder->blocks=(CAS_BLOCK*)blocks;
+  encoder->count=count;
+  encoder->next=0;
+  encoder->owned=false;
+  encoder->unindexed=false;
+}
+
+
+
+/* release the encoder */
+void encoderClose(ENCODER *encoder)
+{
+  int  i;
+
+  if (encoder==NULL) return;
+
+  if (encoder->cas.allocated) free(encoder->cas.data);
+
+  for (i=SHORT_PULSE;i<=LONG_PULSE;i++) free(encoder->pulseWave[i]);
+
+  free(encoder->pulseData);
+
+  free(encoder->byteWave[0].data);
+  free(encoder->scratch);
+  if (encoder->owned) free(encoder->blocks);
+  free(encoder);
+}
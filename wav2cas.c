@@ -24,482 +24,411 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <memory.h>
 
-#ifndef bool
-#define true   1
-#define false  0
-#define bool   int
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
 #endif
 
-#define THRESHOLD_SILENCE   100
-#define THRESHOLD_HEADER    25
-
-/* CPU type defines */
-#if (BIGENDIAN)
-#define BIGENDIANSHORT(value)  ( ((value & 0x00FF) << 8) | \
-                                 ((value & 0xFF00) >>8 ) )
-#define BIGENDIANINT(value)    ( ((value & 0x000000FF) << 24) | \
-                                 ((value & 0x0000FF00) << 8)  | \
-                                 ((value & 0x00FF0000) >> 8)  | \
-                                 ((value & 0xFF000000) >> 24) )
-#define	BIGENDIANLONG(value)   BIGENDIANINT(value) // I suppose Long=int
-#else
-#define BIGENDIANSHORT(value) value
-#define BIGENDIANINT(value)   value
-#define	BIGENDIANLONG(value)  value
-#endif
+#include "castools.h"
+#include "batch.h"
 
 /* default arguments */
-int   threshold = 5;     /* amplitude threshold  */
-bool  envelope  = 2;     /* envelope correction  */
-bool  normalize = false; /* amplitude normalize  */
-bool  phase     = true;  /* phase shift */
-float window    = 1.5;   /* window factor */
+DECODER_SETTINGS defaults = DECODER_DEFAULTS;
+char *statsfile = NULL;
 
-/* header definitions of a wav file */
-typedef struct
-{
-  char     RiffID[4];
-  uint32_t RiffSize;
-  char     WaveID[4];
-  char     FmtID[4];
-  uint32_t FmtSize;
-  uint16_t wFormatTag;
-  uint16_t nChannels;
-  uint32_t nSamplesPerSec;
-  uint32_t nAvgBytesPerSec;
-  uint16_t nBlockAlign;
-  uint16_t wBitsPerSample;
-} WAVE_HEADER;
+/* live decoding of a stream, raw PCM if a rate is given */
+bool live = false;
+int  rawRate = 0;
+int  rawBits = 8;
+int  rawChannels = 1;
 
+/* what a live decoder has written so far */
 typedef struct
 {
-  char     DataID[4];
-  uint32_t nDataBytes;
-} WAVE_BLOCK;
+  DECODER *decoder;
+  FILE    *output;
+  FILE    *messages;
+  int64_t  blocks;
+  int64_t  failed;       /* stretches that could not be read */
+  double   latency;      /* total and largest, in seconds */
+  double   worst;
+} LIVE;
 
 
 
-/* Read wav file for tape image */
-int tapeRead(char* szFileName, int8_t** pBuffer, int32_t *size)
+/* show a brief description */
+void showUsage(char *progname)
 {
-  FILE* wav_file;
-  WAVE_HEADER header;
-  WAVE_BLOCK  block;
-
-  int  adder;
-  int32_t i,j,pos;
-  int8_t data;
-  bool found;
-
-  if ((wav_file=fopen(szFileName,"rb"))==NULL) return -1;
-
-  fread(&header,sizeof(header),1,wav_file);
-
-  /* Make header compatible with PPC micro */
-  #if (BIGENDIAN)
-  header.RiffSize       = BIGENDIANLONG(header.RiffSize);
-  header.FmtSize        = BIGENDIANLONG(header.FmtSize);
-  header.nSamplesPerSec = BIGENDIANLONG(header.nSamplesPerSec);
-  header.nAvgBytesPerSec= BIGENDIANLONG(header.nAvgBytesPerSec);
-  header.wFormatTag     = BIGENDIANSHORT(header.wFormatTag);
-  header.nChannels      = BIGENDIANSHORT(header.nChannels);
-  header.nBlockAlign    = BIGENDIANSHORT(header.nBlockAlign);
-  header.wBitsPerSample = BIGENDIANSHORT(header.wBitsPerSample);
-  #endif
-
-  /* Determine how many bytes to skip in reading file for 8-bit mono */
-  adder=header.nChannels*(header.wBitsPerSample/8);
-
-  /* Search for data tag */
-  found = false;
-  pos = ftell(wav_file);
-  while(fread(&block,sizeof(block),1,wav_file))
-    if (!strncmp(block.DataID,"data",4)) {
-      *size=BIGENDIANLONG(block.nDataBytes)/adder ;
-      *pBuffer=(int8_t*)malloc(*size*sizeof(int8_t));
-      found = true;
-      break;
-    } else {
-      fseek(wav_file,pos++,SEEK_SET);
-    }
-
-  /* Basic error handling */
-  if (!found) {
-    fprintf(stderr,"Incorrect wav header!\n");
-    return -1;
-  }
-
-  if (*pBuffer==NULL) {
-    fprintf(stderr,"Not enough memory!\n");
-    return -1;
-  }
-
-  /* Show wav info */
-  printf("Reading %s (%d Hz, %d-bits, %s)...\n",
-	 szFileName,
-	 (int)header.nSamplesPerSec,
-	 (int)header.wBitsPerSample,
-	 header.nChannels==1 ? "mono" : "stereo" );
-
-  /* Read file */
-  for (i=0;i<(*size);i++) {
-
-    for (j=1; j<adder; j++) fread(&data,sizeof(int8_t),1,wav_file);
-    fread(&data,sizeof(int8_t),1,wav_file);
-    if (header.wBitsPerSample==8) data^=128;
-    if (phase) data=-data;
-    (*pBuffer)[i]=data;
-  }
-
-  fclose(wav_file);
-  return header.nSamplesPerSec;
+  printf("usage: %s [-npsfcdx] [-t threshold] [-w window] [-e envelope] [-j threads]\n"
+	 "          [-r rate] [-m stats] <ifile> <ofile>\n"
+	 "       %s -l [-a rate[:bits[:channels]]] [options] <ifile|-> <ofile|->\n"
+	 "       %s [options] -b <joblist|directory>\n"
+	 " -n   normalize amplitude level\n"
+	 " -p   phase shift signal\n"
+	 " -w   window factor (default:%.1f)\n"
+	 " -e   level of envelope correction (default:%d)\n"
+	 " -t   threshold factor (default:%d)\n"
+	 " -j   decode on multiple threads, splitting at long silences\n"
+	 " -r   decode at a lower sample rate (at least rate Hz)\n"
+	 " -s   sweep the settings above, and keep the best result\n"
+	 " -f   read the bits by their tones instead of measuring pulses\n"
+	 " -c   read data that could not be read again with other settings\n"
+	 " -d   decode both channels of a stereo recording at the same time,\n"
+	 "      and keep the best of each block\n"
+	 " -x   like -d, with the sum and the difference of the channels as well\n"
+	 " -m   write counters and time per stage as JSON to a file, or with -\n"
+	 "      as the only output on stdout (messages go to stderr then)\n"
+	 " -l   live: decode a stream (like a pipe) as it comes in, and write\n"
+	 "      each block as soon as it is read\n"
+	 " -a   the stream is raw PCM (default: 8 bits, 1 channel)\n"
+	 " -b   convert all jobs in a list (lines of: ifile ofile [options])\n"
+	 "      or all .wav files in a directory, on -j threads (default: all)\n"
+	 ,progname,progname,progname,defaults.window,defaults.envelope,defaults.threshold);
 }
 
 
 
-/* correct envelope and denoise signal */
-void correctEnvelope(int8_t **buffer,int32_t size)
+/* parse command line options, returns false if they are invalid */
+bool parseOptions(int argc, char* argv[], DECODER_SETTINGS *settings,
+		  char **ifile, char **ofile, char **batch, char **stats,
+		  FILE *errors)
 {
-  int32_t i;
-  for (i=1;i<size-1;i++)
+  int i,j;
 
-    (*buffer)[i] = ( 0.5*(*buffer)[i-1] +
-		     1.0*(*buffer)[i]   +
-		     2.0*(*buffer)[i+1]   ) / 3.5;
-}
+  for (i=1; i<argc; i++) {
 
+    /* a lone dash is the standard input or output */
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
 
+      for(j=1;j && argv[i][j]!='\0';j++) {
 
-/* make signal as loud as possible */
-void normalizeAmplitude(int8_t **buffer,int32_t size)
-{
-  int32_t i;
-  int  maximum=0;
-  for (i=0;i<size;i++)
-    if (abs((*buffer)[i])>maximum) maximum=abs((*buffer)[i]);
-  for (i=0;i<size;i++) (*buffer)[i]*=127/(float)maximum;
-}
+	/* options with an argument need one */
+	if (strchr("wtejrbma",argv[i][j]) && i+1>=argc) {
+	  fprintf(errors,"%s: missing argument\n",argv[0]);
+	  return false;
+	}
 
+	switch(argv[i][j]) {
 
+	case 'n': settings->normalize=true; break;
+	case 'p': settings->phase=false; break;
+	case 's': settings->sweep=true; break;
+	case 'f': settings->engine=DECODER_TONES; break;
+	case 'c': settings->recover=true; break;
+	case 'd': if (settings->sources<2) settings->sources=2; break;
+	case 'x': settings->sources=4; break;
+	case 'w': settings->window=atof(argv[++i]);    j=-1; break;
+	case 't': settings->threshold=atoi(argv[++i]); j=-1; break;
+	case 'e': settings->envelope=atoi(argv[++i]);  j=-1; break;
+	case 'j': settings->threads=atoi(argv[++i]);   j=-1; break;
+	case 'r': settings->rate=atoi(argv[++i]);      j=-1; break;
+	case 'm': settings->stats=true; *stats=argv[++i]; j=-1; break;
+	case 'l':
+	case 'a':
+	  if (batch==NULL) {
+	    fprintf(errors,"%s: invalid option\n",argv[0]);
+	    return false;
+	  }
+	  live=true;
+	  if (argv[i][j]=='a') {
+	    sscanf(argv[++i],"%d:%d:%d",&rawRate,&rawBits,&rawChannels);
+	    j=-1;
+	  }
+	  break;
+	case 'b':
+	  if (batch==NULL) {
+	    fprintf(errors,"%s: invalid option\n",argv[0]);
+	    return false;
+	  }
+	  *batch=argv[++i]; j=-1; break;
 
-/* detect silence */
-bool isSilence(int8_t *buffer,int32_t index,int32_t size)
-{
-  int32_t silent=0;
+	default:
+	  fprintf(errors,"%s: invalid option\n",argv[0]);
+	  return false;
+	}
+      }
 
-  while (index<size && silent<THRESHOLD_SILENCE) {
+      continue;
+    }
 
-    if ((buffer[index] >= threshold ||
-	 buffer[index] <= -threshold )) return false;
+    if (*ifile==NULL) { *ifile=argv[i]; continue; }
+    if (*ofile==NULL) { *ofile=argv[i]; continue; }
 
-    silent++; index++;
+    fprintf(errors,"%s: invalid option\n",argv[0]);
+    return false;
   }
 
-  return true;
-}
-
-
-
-/* skip silent parts */
-void skipSilence(int8_t *buffer, int32_t *index, int32_t size)
-{
-  while(*index<size &&
-	(buffer[*index] <= threshold &&
-	 buffer[*index] >= -threshold )) (*index)++;
-}
-
+  if (settings->envelope<0 || settings->envelope>DECODER_MAX_ENVELOPE) {
+    fprintf(errors,"%s: invalid envelope level\n",argv[0]);
+    return false;
+  }
 
+  if (settings->threads<0) {
+    fprintf(errors,"%s: invalid number of threads\n",argv[0]);
+    return false;
+  }
 
-/* get the number of bytes of one pulse */
-int32_t getPulseWidth(int8_t *buffer, int32_t *index, int32_t size)
-{
-  int min = 1000;
-  int max =-1000;
-  int pt  = max;
+  if (settings->rate<0) {
+    fprintf(errors,"%s: invalid sample rate\n",argv[0]);
+    return false;
+  }
 
-  int prev = *index > 0 ? buffer[(*index)-1] : 0;
+  if (live && (rawRate<0 || rawBits<8 || rawBits>32 || rawBits%8 ||
+	       rawChannels<1)) {
+    fprintf(errors,"%s: invalid raw format\n",argv[0]);
+    return false;
+  }
 
-  int32_t width = 0;
-  for(;*index<size;width++) {
+  if (live && (settings->normalize || settings->sweep || settings->threads ||
+	       settings->recover || settings->sources>1)) {
+    fprintf(errors,"%s: -n, -s, -j, -c, -d and -x can not be used live\n",
+	    argv[0]);
+    return false;
+  }
 
-    /* ascending */
-    if (buffer[*index]>prev) {
+  if (settings->sweep && (settings->recover || settings->sources>1)) {
+    fprintf(errors,"%s: -c, -d and -x can not be used with -s\n",argv[0]);
+    return false;
+  }
 
-      if (prev==min) {
+  /* stats written to the standard output are all that is written to it */
+  if (*stats!=NULL && !strcmp(*stats,"-") &&
+      (batch==NULL || (*ofile!=NULL && !strcmp(*ofile,"-")))) {
+    fprintf(errors,"%s: -m - can not be used with other output to -\n",
+	    argv[0]);
+    return false;
+  }
 
-	if (pt-min>=threshold) {
+  return true;
+}
 
-	  while(width>1) {
 
-	    if (buffer[*index]>=pt-(pt-min)/2) break;
-	    width--; (*index)--;
-	  }
 
-	  return width;
-	}
+/* convert a wav file to a .cas file, returns 0 on success */
+int convertWave(char *progname, char *ifile, char *ofile, char *statsfile,
+		JOB *job, DECODER_SETTINGS *settings, FILE *messages,
+		FILE *errors)
+{
+  DECODER *decoder;
+  FILE    *output;
+  STATS   *stats;
+  TIMER    timer;
+  const uint8_t *data;
+  int64_t  size;
+  double   start = wallClock();
+  int      status;
+
+  /* open the sample data, it is processed while decoding */
+  if ((decoder=decoderOpen(ifile,settings,messages,errors))==NULL) {
+
+    fprintf(errors,"%s: failed reading %s\n",progname,ifile);
+    return 1;
+  }
 
-	min=1000;
-      }
+  /* open/create the output data file */
+  if ((output=fopen(ofile,"wb"))==NULL) {
 
-      if (buffer[*index]>max) max=buffer[*index];
-    }
+    fprintf(errors,"%s: failed writing %s\n",progname,ofile);
+    decoderClose(decoder);
+    return 1;
+  }
 
+  status=decoderRun(decoder);
+  stats=decoderStats(decoder);
 
-    /* descending */
-    if (buffer[*index]<prev) {
+  if (status) fprintf(errors,"%s: failed decoding %s\n",progname,ifile);
+  else {
 
-      if (prev==max) {
+    startTimer(stats,&timer);
+    /* there is no data if nothing was decoded */
+    data=decoderData(decoder,&size);
+    if (size>0) fwrite(data,1,size,output);
+    fflush(output);
+    stopTimer(stats,&timer,STAGE_WRITE);
 
-	if (max>pt) pt=max;
-	max=-1000;
-      }
+    if (stats) stats->written=size;
+  }
 
-      if (buffer[*index]<min) min=buffer[*index];
-    }
+  fclose(output);
 
-    prev=buffer[(*index)++];
+  if (stats) {
+    stats->elapsed=wallClock()-start;
+    if (saveStats(progname,statsfile,job,ifile,ofile,status,stats,errors))
+      status=-1;
   }
 
-  return width;
+  decoderClose(decoder);
+  if (status) return 1;
+
+  fprintf(messages,"All done...\n");
+  return 0;
 }
 
 
 
-/* detect headers */
-bool isHeader(int8_t *buffer, int32_t index, int32_t size)
+/* write the data of a block as soon as it is read, and show how long */
+/* after the signal that was                                            */
+void showEvent(const DECODER_EVENT *event, void *context)
 {
-
-  int32_t width;
-  int32_t pulses  = 0;
-  int32_t biggest = 0;
-
-  /* skip first pulse for phase independance */
-  getPulseWidth(buffer,&index,size);
-
-  while (index<size && pulses<THRESHOLD_HEADER ) {
-
-    width = getPulseWidth(buffer,&index,size);
-    if (!biggest) biggest=width;
-    if (width>(float)biggest*window) return false;
-    if (width>biggest) biggest = width;
-    pulses++;
-  }
-
-  if (pulses>=THRESHOLD_HEADER) return true;
-
-  return false;
+  LIVE    *state = (LIVE*)context;
+  uint8_t  data[4096];
+  int64_t  size;
+
+  while ((size=decoderRead(state->decoder,data,sizeof(data)))>0)
+    fwrite(data,1,size,state->output);
+  fflush(state->output);
+
+  if (event->type!=DECODER_BLOCK) return;
+
+  state->blocks++;
+  state->latency+=event->latency;
+  if (event->latency>state->worst) state->worst=event->latency;
+
+  fprintf(state->messages,"[%.1f] block %lld: %lld bytes, written %.1f ms "
+	  "after the signal\n",event->time,(long long)event->block,
+	  (long long)event->bytes,event->latency*1000);
+  if (event->failed>state->failed)
+    fprintf(state->messages,"%lld stretches of data could not be read so far\n",
+	    (long long)event->failed);
+  state->failed=event->failed;
+  fflush(state->messages);
 }
 
 
 
-/* skip header and return average with of a short pulse */
-float skipHeader(int8_t *buffer, int32_t *index, int32_t size)
+/* decode a stream as it comes in, returns 0 on success */
+int convertLive(char *progname, char *ifile, char *ofile, char *statsfile,
+		DECODER_SETTINGS *settings, FILE *messages, FILE *errors)
 {
+  FILE    *input;
+  LIVE     state;
+  STATS   *stats;
+  double   start = wallClock();
+  int      status;
+
+  memset(&state,0,sizeof(state));
+
+  if (!strcmp(ifile,"-")) input=stdin;
+  else if ((input=fopen(ifile,"rb"))==NULL) {
+    fprintf(errors,"%s: failed reading %s\n",progname,ifile);
+    return 1;
+  }
 
-  int32_t  width;
-  int32_t  count   = 0;
-  float average = 0;
+  if (!strcmp(ofile,"-")) state.output=stdout;
+  else if ((state.output=fopen(ofile,"wb"))==NULL) {
+    fprintf(errors,"%s: failed writing %s\n",progname,ofile);
+    if (input!=stdin) fclose(input);
+    return 1;
+  }
 
-  /* skip first pulse for phase independance */
-  getPulseWidth(buffer,index,size);
+  state.messages=messages;
+  state.decoder=decoderOpenStream(input,rawRate,rawBits,rawChannels,settings,
+				  messages,errors);
+  if (state.decoder==NULL) {
+    fprintf(errors,"%s: failed reading %s\n",progname,ifile);
+    if (input!=stdin) fclose(input);
+    if (state.output!=stdout) fclose(state.output);
+    return 1;
+  }
 
-  while (*index<size) {
+  decoderEvents(state.decoder,showEvent,&state);
+  status=decoderRun(state.decoder);
+  stats=decoderStats(state.decoder);
 
-    width=getPulseWidth(buffer,index,size);
+  /* the data after the last block */
+  showEvent(&(DECODER_EVENT){ DECODER_HEADER },&state);
 
-    if (average && width>(float)average*window ) {
+  if (state.blocks)
+    fprintf(messages,"%lld blocks, %lld unreadable stretches, written %.1f ms "
+	    "after the signal on average, %.1f ms at most\n",
+	    (long long)state.blocks,(long long)state.failed,
+	    state.latency/state.blocks*1000,state.worst*1000);
 
-	*index-=width;
-	return average;
-    }
+  if (input!=stdin) fclose(input);
+  if (state.output!=stdout) fclose(state.output);
 
-    /* average=(count*average+width)/++count; */
-    count++; average=((count-1)*average+width)/count;
+  if (stats) {
+    decoderData(state.decoder,&stats->written);
+    stats->elapsed=wallClock()-start;
+    if (saveStats(progname,statsfile,NULL,ifile,ofile,status,stats,errors))
+      status=-1;
   }
 
-  return average;
+  decoderClose(state.decoder);
+  if (status) return 1;
+
+  fprintf(messages,"All done...\n");
+  return 0;
 }
 
 
 
-/* read a byte from wave data */
-int readByte(int8_t *buffer, int32_t *index, int32_t size, float average)
+/* convert the files of a batch job, with its own options */
+int convertJob(JOB *job)
 {
-  int  bit;
-  int32_t width;
-  int  value = 0;
-  int  i;
-
-  /* start bit (int32_t pulse) */
-  width=getPulseWidth(buffer,index,size);
-  if (isSilence(buffer,*index,size) ||
-      width<average*window) return -1;
+  DECODER_SETTINGS settings = defaults;
+  char *ifile = NULL;
+  char *ofile = NULL;
+  char *stats = NULL;
 
-  /* data bits (lsb first) */
-  for (bit=0;bit<8;bit++) {
+  /* the threads are used for the jobs, a job uses one unless it says so */
+  settings.threads=0;
 
-    width=getPulseWidth(buffer,index,size);
-    if (isSilence(buffer,*index,size)) return -1;
+  if (!parseOptions(job->argc,job->argv,&settings,&ifile,&ofile,NULL,&stats,
+		    job->messages))
+    return 1;
 
-    if (width<average*window) {
-
-      value+=(1<<bit);
-      getPulseWidth(buffer,index,size); /* skip 2nd short pulse */
-      if (isSilence(buffer,*index,size)) return -1;
-    }
-  }
-
-  /* two stop bits (four short pulses) */
-  for (i=0;i<3;i++) {
-
-    getPulseWidth(buffer,index,size);
-    if (isSilence(buffer,*index,size)) return -1;
+  if (ifile!=NULL || job->output==NULL) {
+    fprintf(job->messages,"%s: invalid job\n",job->argv[0]);
+    return 1;
   }
-  getPulseWidth(buffer,index,size);
 
-  return value;
-}
-
-
-
-/* show a brief description */
-void showUsage(char *progname)
-{
-  printf("usage: %s [-np] [-t threshold] [-w window] [-e envelope] <ifile> <ofile>\n"
-	 " -n   normalize amplitude level\n"
-	 " -p   phase shift signal\n"
-	 " -w   window factor (default:%.1f)\n"
-	 " -e   level of envelope correction (default:%d)\n"
-	 " -t   threshold factor (default:%d)\n"
-	 ,progname,window,envelope,threshold);
+  /* without a -m of its own the stats go to the stats file of the batch */
+  return convertWave(job->argv[0],job->input,job->output,stats,job,
+		     &settings,job->messages,job->messages);
 }
 
 
 
 int main(int argc, char* argv[])
 {
-  FILE *output;
-  int8_t *buffer;
-  int32_t frequency,size,index,written;
-  float average;
-  int   data,i,j;
-  bool  header;
-
   char  *ifile = NULL;
   char  *ofile = NULL;
+  char  *batch = NULL;
+  FILE  *messages;
 
   /* parse command line options */
-  for (i=1; i<argc; i++) {
-
-    if (argv[i][0]=='-') {
-
-      for(j=1;j && argv[i][j]!='\0';j++)
-
-	switch(argv[i][j]) {
-
-	case 'n': normalize=true; break;
-	case 'p': phase=false; break;
-	case 'w': window=atof(argv[++i]);    j=-1; break;
-	case 't': threshold=atoi(argv[++i]); j=-1; break;
-	case 'e': envelope=atoi(argv[++i]);  j=-1; break;
-
-	default:
-	  fprintf(stderr,"%s: invalid option\n",argv[0]);
-	  exit(1);
-	}
-
-      continue;
-    }
-
-    if (ifile==NULL) { ifile=argv[i]; continue; }
-    if (ofile==NULL) { ofile=argv[i]; continue; }
-
-    fprintf(stderr,"%s: invalid option\n",argv[0]);
-    exit(1);
-  }
-
-  if (ifile==NULL || ofile==NULL) { showUsage(argv[0]); exit(1); }
-
-  /* read the sample data and store it in buffer */
-  frequency=tapeRead(ifile,&buffer,&size);
-  if (frequency<0) {
-
-    fprintf(stderr,"%s: failed reading %s\n",argv[0],ifile);
+  if (!parseOptions(argc,argv,&defaults,&ifile,&ofile,&batch,&statsfile,
+		    stderr))
     exit(1);
-  }
 
-  /* open/create the output data file */
-  if ((output=fopen(ofile,"wb"))==NULL) {
+  /* convert a list or directory of files, the options are the */
+  /* defaults for all jobs                                     */
+  if (batch!=NULL) {
 
-    fprintf(stderr,"%s: failed writing %s\n",argv[0],ofile);
-    exit(1);
+    if (ifile!=NULL) { showUsage(argv[0]); exit(1); }
+    return runBatch(argv[0],batch,".wav",".cas",defaults.threads,statsfile,
+		    convertJob);
   }
 
-  /* work on signal first */
-  if (normalize) normalizeAmplitude(&buffer,size);
-  for(i=0;i<envelope;i++) correctEnvelope(&buffer,size);
-
-  /* let's do it */
-  printf("Decoding audio data...\n");
-
-  /* sample probably starts with some silence before the data, skip it */
-  written=index=0;
-  skipSilence(buffer,&index,size);
-
-  header=false;
-  /* loop through all audio data and extract the contents */
-  for (;index<size;index++) {
-
-    /* detect silent parts and skip them */
-    if (isSilence(buffer,index,size)) {
-
-      printf("[%.1f] skipping silence\n",(double)index/frequency);
-      skipSilence(buffer,&index,size);
-    }
-
-    /* detect header and proces the data block followed */
-    if (isHeader(buffer,index,size)) {
-
-      printf("[%.1f] header detected\n",(double)index/frequency);
-      average=skipHeader(buffer,&index,size);
-
-      /* write .cas header if none already written */
-      if (!header) {
-
-	/* .cas headers always start at fixed positions */
-	for (;written&7;written++) putc(0x00,output);
-
-	/* write a .cas header */
-	putc(0x1f,output); putc(0xa6,output);
-	putc(0xde,output); putc(0xba,output);
-	putc(0xcc,output); putc(0x13,output);
-	putc(0x7d,output); putc(0x74,output);
-	written+=8;
-	header=true;
-      }
-
-      printf("[%.1f] data block\n",(double)index/frequency);
+  if (ifile==NULL || ofile==NULL) { showUsage(argv[0]); exit(1); }
 
-      while (!isSilence(buffer,index,size) && index<size) {
-	data=readByte(buffer,&index,size,average);
-	if (data>=0) { putc(data,output); written++; header=false; }
-	else break;
-      }
+  /* stats written to the standard output are not mixed with messages */
+  messages= statsfile!=NULL && !strcmp(statsfile,"-") ? stderr : stdout;
 
-    } else {
+  if (live) {
 
-      /* data found without a header, skip it */
-      printf("[%.1f] skipping headerless data\n",(double)index/frequency);
-      while(!isSilence(buffer,index,size) && index<size ) index++;
-    }
+    #ifdef _WIN32
+    setmode(fileno(stdin),O_BINARY);
+    setmode(fileno(stdout),O_BINARY);
+    #endif
 
+    /* .cas data written to the standard output is not mixed with messages */
+    return convertLive(argv[0],ifile,ofile,statsfile,&defaults,
+		       strcmp(ofile,"-") ? messages : stderr,stderr);
   }
 
-  fclose(output);
-  free(buffer);
-
-  printf("All done...\n");
-  return 0;
+  return convertWave(argv[0],ifile,ofile,statsfile,NULL,&defaults,messages,
+		     stderr);
 }